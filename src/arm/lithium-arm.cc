@@ -2162,6 +2162,13 @@ LInstruction* LChunkBuilder::DoStackCheck(HStackCheck* instr) {
 }
 
 
+LInstruction* LChunkBuilder::DoSTMBarrier(HSTMBarrier* instr) {
+  // STM barriers are implemented on ia32 only.
+  Abort("Unsupported STM barrier");
+  return NULL;
+}
+
+
 LInstruction* LChunkBuilder::DoEnterInlined(HEnterInlined* instr) {
   HEnvironment* outer = current_block_->last_environment();
   HConstant* undefined = graph()->GetConstantUndefined();
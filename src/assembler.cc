@@ -766,6 +766,22 @@ ExternalReference ExternalReference::
 }
 
 
+ExternalReference ExternalReference::
+    stm_load_barrier_function(Isolate* isolate) {
+  return ExternalReference(Redirect(
+      isolate,
+      FUNCTION_ADDR(STM::LoadBarrier)));
+}
+
+
+ExternalReference ExternalReference::
+    stm_store_barrier_function(Isolate* isolate) {
+  return ExternalReference(Redirect(
+      isolate,
+      FUNCTION_ADDR(STM::StoreBarrier)));
+}
+
+
 ExternalReference ExternalReference::flush_icache_function(Isolate* isolate) {
   return ExternalReference(Redirect(isolate, FUNCTION_ADDR(CPU::FlushICache)));
 }
@@ -85,6 +85,19 @@ Handle<CompilationCacheTable> CompilationSubCache::GetTable(int generation) {
   return result;
 }
 
+MaybeObject* CompilationSubCache::TryGetFirstTable() {
+  ASSERT(kFirstGeneration < generations_);
+  if (tables_[kFirstGeneration]->IsUndefined()) {
+    Object* result;
+    { MaybeObject* maybe_result =
+          CompilationCacheTable::Allocate(kInitialCacheSize);
+      if (!maybe_result->ToObject(&result)) return maybe_result;
+    }
+    tables_[kFirstGeneration] = result;
+  }
+  return tables_[kFirstGeneration];
+}
+
 void CompilationSubCache::Age() {
   // Age the generations implicitly killing off the oldest.
   for (int i = generations_ - 1; i > 0; i--) {
@@ -226,8 +239,18 @@ Handle<SharedFunctionInfo> CompilationCacheScript::Lookup(Handle<String> source,
 MaybeObject* CompilationCacheScript::TryTablePut(
     Handle<String> source,
     Handle<SharedFunctionInfo> function_info) {
-  Handle<CompilationCacheTable> table = GetFirstTable();
-  return table->Put(*source, *function_info);
+  SharedHeapScope shared_heap_scope(isolate()->heap());
+  Object* table;
+  { MaybeObject* maybe_table = TryGetFirstTable();
+    if (!maybe_table->ToObject(&table)) return maybe_table;
+  }
+  Object* result;
+  { MaybeObject* maybe_result =
+        CompilationCacheTable::cast(table)->Put(*source, *function_info);
+    if (!maybe_result->ToObject(&result)) return maybe_result;
+  }
+  SetFirstTable(result);
+  return result;
 }
 
 
@@ -243,7 +266,7 @@ Handle<CompilationCacheTable> CompilationCacheScript::TablePut(
 void CompilationCacheScript::Put(Handle<String> source,
                                  Handle<SharedFunctionInfo> function_info) {
   HandleScope scope(isolate());
-  SetFirstTable(TablePut(source, function_info));
+  TablePut(source, function_info);
 }
 
 
@@ -284,8 +307,18 @@ MaybeObject* CompilationCacheEval::TryTablePut(
     Handle<String> source,
     Handle<Context> context,
     Handle<SharedFunctionInfo> function_info) {
-  Handle<CompilationCacheTable> table = GetFirstTable();
-  return table->PutEval(*source, *context, *function_info);
+  SharedHeapScope shared_heap_scope(isolate()->heap());
+  Object* table;
+  { MaybeObject* maybe_table = TryGetFirstTable();
+    if (!maybe_table->ToObject(&table)) return maybe_table;
+  }
+  Object* result;
+  { MaybeObject* maybe_result = CompilationCacheTable::cast(table)->PutEval(
+        *source, *context, *function_info);
+    if (!maybe_result->ToObject(&result)) return maybe_result;
+  }
+  SetFirstTable(result);
+  return result;
 }
 
 
@@ -303,7 +336,7 @@ void CompilationCacheEval::Put(Handle<String> source,
                                Handle<Context> context,
                                Handle<SharedFunctionInfo> function_info) {
   HandleScope scope(isolate());
-  SetFirstTable(TablePut(source, context, function_info));
+  TablePut(source, context, function_info);
 }
 
 
@@ -341,8 +374,18 @@ MaybeObject* CompilationCacheRegExp::TryTablePut(
     Handle<String> source,
     JSRegExp::Flags flags,
     Handle<FixedArray> data) {
-  Handle<CompilationCacheTable> table = GetFirstTable();
-  return table->PutRegExp(*source, flags, *data);
+  SharedHeapScope shared_heap_scope(isolate()->heap());
+  Object* table;
+  { MaybeObject* maybe_table = TryGetFirstTable();
+    if (!maybe_table->ToObject(&table)) return maybe_table;
+  }
+  Object* result;
+  { MaybeObject* maybe_result =
+        CompilationCacheTable::cast(table)->PutRegExp(*source, flags, *data);
+    if (!maybe_result->ToObject(&result)) return maybe_result;
+  }
+  SetFirstTable(result);
+  return result;
 }
 
 
@@ -360,7 +403,7 @@ void CompilationCacheRegExp::Put(Handle<String> source,
                                  JSRegExp::Flags flags,
                                  Handle<FixedArray> data) {
   HandleScope scope(isolate());
-  SetFirstTable(TablePut(source, flags, data));
+  TablePut(source, flags, data);
 }
 
 
@@ -58,9 +58,14 @@ class CompilationSubCache {
   Handle<CompilationCacheTable> GetFirstTable() {
     return GetTable(kFirstGeneration);
   }
-  void SetFirstTable(Handle<CompilationCacheTable> value) {
+
+  // Raw accessors for puts.  Threads running transactions (--stm) share the
+  // tables, so a put holds SharedHeapScope from reading the first table
+  // until the table it returns is stored.
+  MUST_USE_RESULT MaybeObject* TryGetFirstTable();
+  void SetFirstTable(Object* value) {
     ASSERT(kFirstGeneration < generations_);
-    tables_[kFirstGeneration] = *value;
+    tables_[kFirstGeneration] = value;
   }
 
   // Age the sub-cache by evicting the oldest generation and creating a new
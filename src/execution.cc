@@ -450,6 +450,38 @@ void StackGuard::RequestGC() {
 }
 
 
+bool StackGuard::IsSTMAbort() {
+  ExecutionAccess access(isolate_);
+  return (thread_local_.interrupt_flags_ & STM_ABORT) != 0;
+}
+
+
+void StackGuard::RequestSTMAbort(int thread_index) {
+  ExecutionAccess access(isolate_);
+  thread_local_.interrupt_flags_ |= STM_ABORT;
+  if (thread_local_.postpone_interrupts_nesting_ == 0) {
+    thread_local_.jslimit_ = thread_local_.climit_ = kInterruptLimit;
+    isolate_->heap()->SetStackLimits(thread_index, this);
+  }
+}
+
+
+bool StackGuard::IsSTMSafepoint() {
+  ExecutionAccess access(isolate_);
+  return (thread_local_.interrupt_flags_ & STM_SAFEPOINT) != 0;
+}
+
+
+void StackGuard::RequestSTMSafepoint(int thread_index) {
+  ExecutionAccess access(isolate_);
+  thread_local_.interrupt_flags_ |= STM_SAFEPOINT;
+  if (thread_local_.postpone_interrupts_nesting_ == 0) {
+    thread_local_.jslimit_ = thread_local_.climit_ = kInterruptLimit;
+    isolate_->heap()->SetStackLimits(thread_index, this);
+  }
+}
+
+
 #ifdef ENABLE_DEBUGGER_SUPPORT
 bool StackGuard::IsDebugBreak() {
   ExecutionAccess access(isolate_);
@@ -817,6 +849,18 @@ MaybeObject* Execution::HandleStackGuardInterrupt() {
     DebugBreakHelper();
   }
 #endif
+  if (stack_guard->IsSTMSafepoint()) {
+    stack_guard->Continue(STM_SAFEPOINT);
+    // request outlives GC if the thread paused at allocation
+    isolate->stm()->PauseForGC();
+  }
+  if (stack_guard->IsSTMAbort()) {
+    stack_guard->Continue(STM_ABORT);
+    // request can outlive the aborted attempt, then it is ignored
+    if (isolate->stm()->IsDoomed()) {
+      return isolate->TerminateExecution();
+    }
+  }
   if (stack_guard->IsTerminateExecution()) {
     stack_guard->Continue(TERMINATE);
     return isolate->TerminateExecution();
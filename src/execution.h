@@ -42,7 +42,9 @@ enum InterruptFlag {
   PREEMPT = 1 << 3,
   TERMINATE = 1 << 4,
   RUNTIME_PROFILER_TICK = 1 << 5,
-  GC_REQUEST = 1 << 6
+  GC_REQUEST = 1 << 6,
+  STM_ABORT = 1 << 7,
+  STM_SAFEPOINT = 1 << 8
 };
 
 class Execution : public AllStatic {
@@ -194,6 +196,13 @@ class StackGuard {
 #endif
   bool IsGCRequest();
   void RequestGC();
+  // Transaction of the thread owning this stack guard was aborted by other
+  // thread, thread_index identifies stack limits of the owning thread.
+  bool IsSTMAbort();
+  void RequestSTMAbort(int thread_index);
+  // Other thread needs GC, the owning thread pauses for it.
+  bool IsSTMSafepoint();
+  void RequestSTMSafepoint(int thread_index);
   void Continue(InterruptFlag after_what);
 
   // This provides an asynchronous read of the stack limits for the current
@@ -1224,6 +1224,8 @@ Handle<MapCache> Factory::NewMapCache(int at_least_space_for) {
 MUST_USE_RESULT static MaybeObject* UpdateMapCacheWith(Context* context,
                                                        FixedArray* keys,
                                                        Map* map) {
+  // The global context is shared by threads running transactions (--stm).
+  SharedHeapScope shared_heap_scope(context->GetHeap());
   Object* result;
   { MaybeObject* maybe_result =
         MapCache::cast(context->map_cache())->Put(keys, map);
@@ -342,6 +342,8 @@ DEFINE_int(testing_int_flag, 13, "testing_int_flag")
 DEFINE_float(testing_float_flag, 2.5, "float-flag")
 DEFINE_string(testing_string_flag, "Hello, world!", "string-flag")
 DEFINE_int(testing_prng_seed, 42, "Seed used for threading test randomness")
+DEFINE_bool(testing_benchmarks, false,
+            "run the benchmark tests at full size and print their timings")
 #ifdef WIN32
 DEFINE_string(testing_serialization_file, "C:\\Windows\\Temp\\serdes",
               "file in which to testing_serialize heap")
@@ -534,8 +536,31 @@ DEFINE_bool(print_builtin_code, false, "print generated code for builtins")
 
 // main.cc / stm.cc
 DEFINE_bool(stm, true, "run code in transactions (threads must be 1 otherwise)")
+DEFINE_bool(stm_version_clock, false,
+            "validate transactions against global version clock at commit")
 DEFINE_int(threads, 1, "number of event loops to run in parallel")
+DEFINE_bool(stm_mvcc, false,
+            "read-only transactions read snapshots of objects written later")
 DEFINE_bool(stm_aborts, false, "abort each other transaction (for testing)")
+DEFINE_string(stm_contention, "none",
+              "policy for aborted events (none, backoff, priority, serialize)")
+DEFINE_int(stm_backoff_max, 1024,
+           "maximal delay of aborted event in microseconds (backoff policy)")
+DEFINE_int(stm_serialize_after, 8,
+           "aborts after which event runs alone (serialize policy)")
+DEFINE_bool(stm_stats, false, "print contention statistics at exit")
+DEFINE_int(event_batch, 16,
+           "maximal number of queued events run in one transaction")
+DEFINE_bool(adaptive_threads, true,
+            "vary number of workers running events with throughput and aborts")
+DEFINE_bool(parallel_scavenge, true,
+            "threads paused for scavenge help with copying")
+DEFINE_bool(parallel_marking, true,
+            "threads paused for full GC help with marking")
+DEFINE_bool(parallel_compaction, true,
+            "threads paused for full GC help with evacuation")
+DEFINE_bool(concurrent_sweeping, true,
+            "sweep old spaces on a background thread after full GC")
 
 // Cleanup...
 #undef FLAG_FULL
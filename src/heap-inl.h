@@ -197,7 +197,7 @@ MaybeObject* Heap::AllocateRaw(int size_in_bytes,
 #endif
   MaybeObject* result;
   if (NEW_SPACE == space) {
-    result = new_space_.AllocateRaw(size_in_bytes);
+    result = AllocateRawInNewSpace(size_in_bytes);
     if (always_allocate() && result->IsFailure()) {
       space = retry_space;
     } else {
@@ -205,7 +205,9 @@ MaybeObject* Heap::AllocateRaw(int size_in_bytes,
     }
   }
 
-  if (OLD_POINTER_SPACE == space) {
+  if (FLAG_stm && space < kLocalAllocationSpaces) {
+    result = AllocateRawLocal(size_in_bytes, space);
+  } else if (OLD_POINTER_SPACE == space) {
     result = old_pointer_space_->AllocateRaw(size_in_bytes);
   } else if (OLD_DATA_SPACE == space) {
     result = old_data_space_->AllocateRaw(size_in_bytes);
@@ -258,6 +260,25 @@ void Heap::FinalizeExternalString(String* string) {
 }
 
 
+MaybeObject* Heap::AllocateRawInNewSpace(int size_in_bytes) {
+  if (FLAG_stm) {
+    return AllocateRawLocal(size_in_bytes, NEW_SPACE);
+  }
+  return new_space_.AllocateRaw(size_in_bytes);
+}
+
+
+MaybeObject* Heap::AllocateRawLocal(int size_in_bytes, AllocationSpace space) {
+  AllocationInfo* buffer = &local_allocation_buffers_[ThreadIndex()][space];
+  Address top = buffer->top;
+  if (buffer->limit - top >= size_in_bytes) {
+    buffer->top = top + size_in_bytes;
+    return HeapObject::FromAddress(top);
+  }
+  return RefillLocalAllocationBuffer(size_in_bytes, space);
+}
+
+
 MaybeObject* Heap::AllocateRawMap() {
 #ifdef DEBUG
   isolate_->counters()->objs_since_last_full()->Increment();
@@ -118,6 +118,7 @@ Heap::Heap()
       amount_of_external_allocated_memory_(0),
       amount_of_external_allocated_memory_at_last_global_gc_(0),
       old_gen_exhausted_(false),
+      shared_heap_mutex_(OS::CreateMutex()),
       store_buffer_rebuilder_(store_buffer()),
       hidden_symbol_(NULL),
       global_gc_prologue_callback_(NULL),
@@ -165,6 +166,7 @@ Heap::Heap()
 
   memset(roots_, 0, sizeof(roots_[0]) * kRootListLength);
   memset(thread_roots_, 0, sizeof(thread_roots_));
+  memset(scavenge_contexts_, 0, sizeof(scavenge_contexts_));
   global_contexts_list_ = NULL;
   mark_compact_collector_.heap_ = this;
   external_string_table_.heap_ = this;
@@ -367,6 +369,7 @@ void Heap::ReportStatisticsAfterGC() {
 
 
 void Heap::GarbageCollectionPrologue() {
+  if (FLAG_stm) ReleaseLocalAllocationBuffers();
   FOR_ALL_THREADS(isolate_->transcendental_cache(thread)->Clear());
   ClearJSFunctionResultCaches();
   gc_count_++;
@@ -471,6 +474,9 @@ bool Heap::CollectGarbage(AllocationSpace space, GarbageCollector collector) {
     return true;
   }
 
+  // Waits for the concurrent sweeper to finish its page.
+  ScopedLock sweeping(mark_compact_collector()->sweeping_mutex());
+
   // The VM is in the GC state until exiting this function.
   VMState state(isolate_, GC);
 
@@ -1013,7 +1019,8 @@ void Heap::Scavenge() {
 
   CheckNewSpaceExpansionCriteria();
 
-  SelectScavengingVisitorsTable();
+  bool in_parallel = CanScavengeInParallel();
+  SelectScavengingVisitorsTable(in_parallel);
 
   incremental_marking()->PrepareForScavenge();
 
@@ -1049,41 +1056,21 @@ void Heap::Scavenge() {
   store_buffer()->Clean();
 #endif
 
-  ScavengeVisitor scavenge_visitor(this);
-  // Copy roots.
-  IterateRoots(&scavenge_visitor, VISIT_ALL_IN_SCAVENGE);
+  if (in_parallel) {
+    ScavengeInParallel();
+    new_space_front = new_space_.top();
+  } else {
+    ScavengeVisitor scavenge_visitor(this);
+    ScavengeRoots(&scavenge_visitor, &ScavengeObject);
 
-  // Copy objects reachable from the old generation.
-  {
-    StoreBufferRebuildScope scope(this,
-                                  store_buffer(),
-                                  &ScavengeStoreBufferCallback);
-    store_buffer()->IteratePointersToNewSpace(&ScavengeObject);
+    new_space_front = DoScavenge(&scavenge_visitor, new_space_front);
+    isolate_->global_handles()->IdentifyNewSpaceWeakIndependentHandles(
+        &IsUnscavengedHeapObject);
+    isolate_->global_handles()->IterateNewSpaceWeakIndependentRoots(
+        &scavenge_visitor);
+    new_space_front = DoScavenge(&scavenge_visitor, new_space_front);
   }
 
-  // Copy objects reachable from cells by scavenging cell values directly.
-  HeapObjectIterator cell_iterator(cell_space_);
-  for (HeapObject* cell = cell_iterator.Next();
-       cell != NULL; cell = cell_iterator.Next()) {
-    if (cell->IsJSGlobalPropertyCell()) {
-      Address value_address =
-          reinterpret_cast<Address>(cell) +
-          (JSGlobalPropertyCell::kValueOffset - kHeapObjectTag);
-      scavenge_visitor.VisitPointer(reinterpret_cast<Object**>(value_address));
-    }
-  }
-
-  // Scavenge object reachable from the global contexts list directly.
-  scavenge_visitor.VisitPointer(BitCast<Object**>(&global_contexts_list_));
-
-  new_space_front = DoScavenge(&scavenge_visitor, new_space_front);
-  isolate_->global_handles()->IdentifyNewSpaceWeakIndependentHandles(
-      &IsUnscavengedHeapObject);
-  isolate_->global_handles()->IterateNewSpaceWeakIndependentRoots(
-      &scavenge_visitor);
-  new_space_front = DoScavenge(&scavenge_visitor, new_space_front);
-
-
   UpdateNewSpaceReferencesInExternalStringTable(
       &UpdateNewSpaceReferenceInExternalStringTableEntry);
 
@@ -1109,6 +1096,37 @@ void Heap::Scavenge() {
 }
 
 
+void Heap::ScavengeRoots(ObjectVisitor* scavenge_visitor,
+                         ObjectSlotCallback scavenge_callback) {
+  // Copy roots.
+  IterateRoots(scavenge_visitor, VISIT_ALL_IN_SCAVENGE);
+
+  // Copy objects reachable from the old generation.
+  {
+    StoreBufferRebuildScope scope(this,
+                                  store_buffer(),
+                                  &ScavengeStoreBufferCallback);
+    store_buffer()->IteratePointersToNewSpace(scavenge_callback);
+  }
+
+  // Copy objects reachable from cells by scavenging cell values directly.
+  HeapObjectIterator cell_iterator(cell_space_);
+  for (HeapObject* cell = cell_iterator.Next();
+       cell != NULL; cell = cell_iterator.Next()) {
+    if (cell->IsJSGlobalPropertyCell()) {
+      Address value_address =
+          reinterpret_cast<Address>(cell) +
+          (JSGlobalPropertyCell::kValueOffset - kHeapObjectTag);
+      scavenge_visitor->VisitPointer(
+          reinterpret_cast<Object**>(value_address));
+    }
+  }
+
+  // Scavenge object reachable from the global contexts list directly.
+  scavenge_visitor->VisitPointer(BitCast<Object**>(&global_contexts_list_));
+}
+
+
 String* Heap::UpdateNewSpaceReferenceInExternalStringTableEntry(Heap* heap,
                                                                 Object** p) {
   MapWord first_word = HeapObject::cast(*p)->map_word();
@@ -1327,6 +1345,118 @@ Address Heap::DoScavenge(ObjectVisitor* scavenge_visitor,
 }
 
 
+// Buffers that a thread copies objects to in a parallel scavenge and the
+// copied objects whose pointers are not scavenged yet.  Slots of promoted
+// objects that point to new space are entered into the store buffer by the
+// GC thread when copying is done (see ScavengeInParallel).
+class ScavengeContext {
+ public:
+  explicit ScavengeContext(Heap* heap) : heap_(heap), promoted_size_(0) {
+    for (int i = 0; i < kSpaces; i++) {
+      buffers_[i].top = NULL;
+      buffers_[i].limit = NULL;
+    }
+  }
+
+  // Space is the new space or one of the old spaces for promotion.
+  MaybeObject* AllocateRaw(AllocationSpace space, int size_in_bytes) {
+    ASSERT(space < kSpaces);
+    if (size_in_bytes > kBufferSize / 4) {
+      return AllocateShared(space, size_in_bytes);
+    }
+    AllocationInfo* buffer = &buffers_[space];
+    if (buffer->limit - buffer->top < size_in_bytes) {
+      ReleaseBuffer(space);
+      Object* result;
+      MaybeObject* maybe_result = AllocateShared(space, kBufferSize);
+      if (!maybe_result->ToObject(&result)) {
+        // The space may still have room for the object itself.
+        return AllocateShared(space, size_in_bytes);
+      }
+      buffer->top = HeapObject::cast(result)->address();
+      buffer->limit = buffer->top + kBufferSize;
+    }
+    HeapObject* object = HeapObject::FromAddress(buffer->top);
+    buffer->top += size_in_bytes;
+    return object;
+  }
+
+  bool IsEmpty() { return objects_.is_empty(); }
+  int length() { return objects_.length(); }
+  void Push(HeapObject* object) { objects_.Add(object); }
+  HeapObject* Pop() { return objects_.RemoveLast(); }
+
+  void RecordSlot(Address slot) { slots_.Add(slot); }
+  void RecordPromotion(int size) { promoted_size_ += size; }
+
+  // Called by the GC thread after copying.
+  void Finish() {
+    ASSERT(objects_.is_empty());
+    for (int i = 0; i < kSpaces; i++) {
+      ReleaseBuffer(static_cast<AllocationSpace>(i));
+    }
+    for (int i = 0; i < slots_.length(); i++) {
+      heap_->store_buffer()->EnterDirectlyIntoStoreBuffer(slots_[i]);
+    }
+    slots_.Clear();
+    heap_->tracer()->increment_promoted_objects_size(promoted_size_);
+    promoted_size_ = 0;
+  }
+
+ private:
+  static const int kBufferSize = 8 * KB;
+  static const int kSpaces = OLD_DATA_SPACE + 1;
+
+  PagedSpace* OldSpace(AllocationSpace space) {
+    ASSERT(space == OLD_POINTER_SPACE || space == OLD_DATA_SPACE);
+    return (space == OLD_POINTER_SPACE)
+        ? static_cast<PagedSpace*>(heap_->old_pointer_space())
+        : static_cast<PagedSpace*>(heap_->old_data_space());
+  }
+
+  MaybeObject* AllocateShared(AllocationSpace space, int size_in_bytes) {
+    return (space == NEW_SPACE)
+        ? heap_->new_space()->AllocateRaw(size_in_bytes)
+        : OldSpace(space)->AllocateRaw(size_in_bytes);
+  }
+
+  void ReleaseBuffer(AllocationSpace space) {
+    AllocationInfo* buffer = &buffers_[space];
+    if (buffer->top < buffer->limit) {
+      int size = static_cast<int>(buffer->limit - buffer->top);
+      if (space == NEW_SPACE) {
+        heap_->CreateFillerObjectAt(buffer->top, size);
+      } else {
+        SharedHeapScope shared_heap(heap_);
+        OldSpace(space)->Free(buffer->top, size);
+      }
+    }
+    buffer->top = NULL;
+    buffer->limit = NULL;
+  }
+
+  Heap* heap_;
+  AllocationInfo buffers_[kSpaces];
+  List<HeapObject*> objects_;
+  List<Address> slots_;
+  intptr_t promoted_size_;
+};
+
+
+// A thread scavenging in parallel claims an object in from space by storing
+// this into its map word before copying it, other threads wait for the
+// forwarding address (see ScavengeObjectInParallel).
+static const AtomicWord kClaimedMapWord = 0;
+
+
+static inline volatile AtomicWord* MapWordSlot(HeapObject* object) {
+  return reinterpret_cast<volatile AtomicWord*>(object->address());
+}
+
+
+static void ScavengeObjectInParallel(HeapObject** p, HeapObject* object);
+
+
 enum LoggingAndProfiling {
   LOGGING_AND_PROFILING_ENABLED,
   LOGGING_AND_PROFILING_DISABLED
@@ -1336,8 +1466,12 @@ enum LoggingAndProfiling {
 enum MarksHandling { TRANSFER_MARKS, IGNORE_MARKS };
 
 
+enum CopyingMode { SERIAL_COPYING, PARALLEL_COPYING };
+
+
 template<MarksHandling marks_handling,
-         LoggingAndProfiling logging_and_profiling_mode>
+         LoggingAndProfiling logging_and_profiling_mode,
+         CopyingMode copying_mode>
 class ScavengingVisitor : public StaticVisitorBase {
  public:
   static void Initialize() {
@@ -1416,18 +1550,35 @@ class ScavengingVisitor : public StaticVisitorBase {
     }
   }
 
+  static inline void SetForwardingAddress(HeapObject* source,
+                                          HeapObject* target) {
+    MapWord forwarding = MapWord::FromForwardingAddress(target);
+    if (copying_mode == PARALLEL_COPYING) {
+      // Threads waiting for the claimed source read the target.
+      Release_Store(MapWordSlot(source),
+                    static_cast<AtomicWord>(forwarding.ToRawValue()));
+    } else {
+      source->set_map_word(forwarding);
+    }
+  }
+
   // Helper function used by CopyObject to copy a source object to an
   // allocated target object and update the forwarding pointer in the source
   // object.  Returns the target object.
   INLINE(static HeapObject* MigrateObject(Heap* heap,
+                                          Map* map,
                                           HeapObject* source,
                                           HeapObject* target,
                                           int size)) {
     // Copy the content of source to target.
     heap->CopyBlock(target->address(), source->address(), size);
+    if (copying_mode == PARALLEL_COPYING) {
+      // The map word of the source was claimed.
+      target->set_map_word(MapWord::FromMap(map));
+    }
 
     // Set the forwarding address.
-    source->set_map_word(MapWord::FromForwardingAddress(target));
+    SetForwardingAddress(source, target);
 
     if (logging_and_profiling_mode == LOGGING_AND_PROFILING_ENABLED) {
       // Update NewSpace stats if necessary.
@@ -1459,9 +1610,15 @@ class ScavengingVisitor : public StaticVisitorBase {
                                     int object_size) {
     ASSERT((size_restriction != SMALL) ||
            (object_size <= Page::kMaxHeapObjectSize));
-    ASSERT(object->Size() == object_size);
+    ASSERT(object->SizeFromMap(map) == object_size);
 
     Heap* heap = map->GetHeap();
+    if (copying_mode == PARALLEL_COPYING) {
+      EvacuateObjectInParallel<object_contents, size_restriction>(
+          heap, map, slot, object, object_size);
+      return;
+    }
+
     if (heap->ShouldBePromoted(object->address(), object_size)) {
       MaybeObject* maybe_result;
 
@@ -1480,7 +1637,7 @@ class ScavengingVisitor : public StaticVisitorBase {
       Object* result = NULL;  // Initialization to please compiler.
       if (maybe_result->ToObject(&result)) {
         HeapObject* target = HeapObject::cast(result);
-        *slot = MigrateObject(heap, object , target, object_size);
+        *slot = MigrateObject(heap, map, object, target, object_size);
 
         if (object_contents == POINTER_OBJECT) {
           heap->promotion_queue()->insert(target, object_size);
@@ -1493,10 +1650,61 @@ class ScavengingVisitor : public StaticVisitorBase {
     MaybeObject* allocation = heap->new_space()->AllocateRaw(object_size);
     Object* result = allocation->ToObjectUnchecked();
 
-    *slot = MigrateObject(heap, object, HeapObject::cast(result), object_size);
+    *slot = MigrateObject(heap,
+                          map,
+                          object,
+                          HeapObject::cast(result),
+                          object_size);
     return;
   }
 
+  // Objects are copied to buffers of the thread, copies with pointers are
+  // scanned by the thread or handed over to an idle one.
+  template<ObjectContents object_contents, SizeRestriction size_restriction>
+  static inline void EvacuateObjectInParallel(Heap* heap,
+                                              Map* map,
+                                              HeapObject** slot,
+                                              HeapObject* object,
+                                              int object_size) {
+    ScavengeContext* context = heap->scavenge_context();
+    Object* result = NULL;
+    bool promoted =
+        heap->ShouldBePromoted(object->address(), object_size) &&
+        Promote<object_contents, size_restriction>(
+            heap, context, object_size)->ToObject(&result);
+    if (!promoted &&
+        !context->AllocateRaw(NEW_SPACE, object_size)->ToObject(&result)) {
+      // Unused ends of buffers may leave no room in to space.
+      promoted = Promote<object_contents, size_restriction>(
+          heap, context, object_size)->ToObject(&result);
+      if (!promoted) {
+        V8::FatalProcessOutOfMemory("Scavenge");
+      }
+    }
+
+    HeapObject* target = HeapObject::cast(result);
+    *slot = MigrateObject(heap, map, object, target, object_size);
+    if (promoted) {
+      context->RecordPromotion(object_size);
+    }
+    if (object_contents == POINTER_OBJECT) {
+      context->Push(target);
+    }
+  }
+
+  template<ObjectContents object_contents, SizeRestriction size_restriction>
+  static inline MaybeObject* Promote(Heap* heap,
+                                     ScavengeContext* context,
+                                     int object_size) {
+    if ((size_restriction != SMALL) &&
+        (object_size > Page::kMaxHeapObjectSize)) {
+      return heap->lo_space()->AllocateRaw(object_size, NOT_EXECUTABLE);
+    }
+    return context->AllocateRaw(
+        (object_contents == DATA_OBJECT) ? OLD_DATA_SPACE : OLD_POINTER_SPACE,
+        object_size);
+  }
+
 
   static inline void EvacuateJSFunction(Map* map,
                                         HeapObject** slot,
@@ -1553,10 +1761,12 @@ class ScavengingVisitor : public StaticVisitorBase {
   }
 
 
+  // The map word of the object may be claimed by a parallel scavenge, sizes
+  // are computed from the map and without checked casts.
   static inline void EvacuateSeqAsciiString(Map* map,
                                             HeapObject** slot,
                                             HeapObject* object) {
-    int object_size = SeqAsciiString::cast(object)->
+    int object_size = reinterpret_cast<SeqAsciiString*>(object)->
         SeqAsciiStringSize(map->instance_type());
     EvacuateObject<DATA_OBJECT, UNKNOWN_SIZE>(map, slot, object, object_size);
   }
@@ -1565,7 +1775,7 @@ class ScavengingVisitor : public StaticVisitorBase {
   static inline void EvacuateSeqTwoByteString(Map* map,
                                               HeapObject** slot,
                                               HeapObject* object) {
-    int object_size = SeqTwoByteString::cast(object)->
+    int object_size = reinterpret_cast<SeqTwoByteString*>(object)->
         SeqTwoByteStringSize(map->instance_type());
     EvacuateObject<DATA_OBJECT, UNKNOWN_SIZE>(map, slot, object, object_size);
   }
@@ -1583,15 +1793,22 @@ class ScavengingVisitor : public StaticVisitorBase {
     Heap* heap = map->GetHeap();
 
     if (marks_handling == IGNORE_MARKS &&
-        ConsString::cast(object)->unchecked_second() ==
+        reinterpret_cast<ConsString*>(object)->unchecked_second() ==
         heap->empty_string()) {
-      HeapObject* first =
-          HeapObject::cast(ConsString::cast(object)->unchecked_first());
+      HeapObject* first = HeapObject::cast(
+          reinterpret_cast<ConsString*>(object)->unchecked_first());
 
       *slot = first;
 
       if (!heap->InNewSpace(first)) {
-        object->set_map_word(MapWord::FromForwardingAddress(first));
+        SetForwardingAddress(object, first);
+        return;
+      }
+
+      if (copying_mode == PARALLEL_COPYING) {
+        // The cons string stays claimed until its first part is copied.
+        ScavengeObjectInParallel(slot, first);
+        SetForwardingAddress(object, *slot);
         return;
       }
 
@@ -1636,22 +1853,43 @@ class ScavengingVisitor : public StaticVisitorBase {
 
 
 template<MarksHandling marks_handling,
-         LoggingAndProfiling logging_and_profiling_mode>
+         LoggingAndProfiling logging_and_profiling_mode,
+         CopyingMode copying_mode>
 VisitorDispatchTable<ScavengingCallback>
-    ScavengingVisitor<marks_handling, logging_and_profiling_mode>::table_;
+    ScavengingVisitor<marks_handling,
+                      logging_and_profiling_mode,
+                      copying_mode>::table_;
 
 
 static void InitializeScavengingVisitorsTables() {
   ScavengingVisitor<TRANSFER_MARKS,
-                    LOGGING_AND_PROFILING_DISABLED>::Initialize();
-  ScavengingVisitor<IGNORE_MARKS, LOGGING_AND_PROFILING_DISABLED>::Initialize();
+                    LOGGING_AND_PROFILING_DISABLED,
+                    SERIAL_COPYING>::Initialize();
+  ScavengingVisitor<IGNORE_MARKS,
+                    LOGGING_AND_PROFILING_DISABLED,
+                    SERIAL_COPYING>::Initialize();
   ScavengingVisitor<TRANSFER_MARKS,
-                    LOGGING_AND_PROFILING_ENABLED>::Initialize();
-  ScavengingVisitor<IGNORE_MARKS, LOGGING_AND_PROFILING_ENABLED>::Initialize();
-}
-
+                    LOGGING_AND_PROFILING_ENABLED,
+                    SERIAL_COPYING>::Initialize();
+  ScavengingVisitor<IGNORE_MARKS,
+                    LOGGING_AND_PROFILING_ENABLED,
+                    SERIAL_COPYING>::Initialize();
+  ScavengingVisitor<IGNORE_MARKS,
+                    LOGGING_AND_PROFILING_DISABLED,
+                    PARALLEL_COPYING>::Initialize();
+}
+
+
+void Heap::SelectScavengingVisitorsTable(bool in_parallel) {
+  if (in_parallel) {
+    // See CanScavengeInParallel.
+    scavenging_visitors_table_.CopyFrom(
+        ScavengingVisitor<IGNORE_MARKS,
+                          LOGGING_AND_PROFILING_DISABLED,
+                          PARALLEL_COPYING>::GetTable());
+    return;
+  }
 
-void Heap::SelectScavengingVisitorsTable() {
   bool logging_and_profiling =
       isolate()->logger()->is_logging() ||
       CpuProfiler::is_profiling(isolate()) ||
@@ -1662,21 +1900,25 @@ void Heap::SelectScavengingVisitorsTable() {
     if (!logging_and_profiling) {
       scavenging_visitors_table_.CopyFrom(
           ScavengingVisitor<IGNORE_MARKS,
-                            LOGGING_AND_PROFILING_DISABLED>::GetTable());
+                            LOGGING_AND_PROFILING_DISABLED,
+                            SERIAL_COPYING>::GetTable());
     } else {
       scavenging_visitors_table_.CopyFrom(
           ScavengingVisitor<IGNORE_MARKS,
-                            LOGGING_AND_PROFILING_ENABLED>::GetTable());
+                            LOGGING_AND_PROFILING_ENABLED,
+                            SERIAL_COPYING>::GetTable());
     }
   } else {
     if (!logging_and_profiling) {
       scavenging_visitors_table_.CopyFrom(
           ScavengingVisitor<TRANSFER_MARKS,
-                            LOGGING_AND_PROFILING_DISABLED>::GetTable());
+                            LOGGING_AND_PROFILING_DISABLED,
+                            SERIAL_COPYING>::GetTable());
     } else {
       scavenging_visitors_table_.CopyFrom(
           ScavengingVisitor<TRANSFER_MARKS,
-                            LOGGING_AND_PROFILING_ENABLED>::GetTable());
+                            LOGGING_AND_PROFILING_ENABLED,
+                            SERIAL_COPYING>::GetTable());
     }
   }
 }
@@ -1691,6 +1933,234 @@ void Heap::ScavengeObjectSlow(HeapObject** p, HeapObject* object) {
 }
 
 
+// Copies the object unless another thread has claimed it.  The copying
+// thread sets the forwarding address when the copy is complete.
+static void ScavengeObjectInParallel(HeapObject** p, HeapObject* object) {
+  ASSERT(HEAP->InFromSpace(object));
+  volatile AtomicWord* map_word_slot = MapWordSlot(object);
+  while (true) {
+    AtomicWord value = Acquire_Load(map_word_slot);
+    if (value == kClaimedMapWord) continue;
+
+    MapWord first_word = MapWord::FromRawValue(value);
+    if (first_word.IsForwardingAddress()) {
+      *p = first_word.ToForwardingAddress();
+      return;
+    }
+
+    if (Acquire_CompareAndSwap(map_word_slot, value, kClaimedMapWord) ==
+        value) {
+      Map* map = first_word.ToMap();
+      map->GetHeap()->DoScavengeObject(map, p, object);
+      return;
+    }
+  }
+}
+
+
+class ParallelScavengeVisitor: public ObjectVisitor {
+ public:
+  explicit ParallelScavengeVisitor(Heap* heap) : heap_(heap) {}
+
+  void VisitPointer(Object** p) { ScavengePointer(p); }
+
+  void VisitPointers(Object** start, Object** end) {
+    for (Object** p = start; p < end; p++) ScavengePointer(p);
+  }
+
+ private:
+  void ScavengePointer(Object** p) {
+    Object* object = *p;
+    if (!heap_->InNewSpace(object)) return;
+    ScavengeObjectInParallel(reinterpret_cast<HeapObject**>(p),
+                             reinterpret_cast<HeapObject*>(object));
+  }
+
+  Heap* heap_;
+};
+
+
+class ParallelNewSpaceScavenger
+    : public StaticNewSpaceVisitor<ParallelNewSpaceScavenger> {
+ public:
+  static inline void VisitPointer(Heap* heap, Object** p) {
+    Object* object = *p;
+    if (!heap->InNewSpace(object)) return;
+    ScavengeObjectInParallel(reinterpret_cast<HeapObject**>(p),
+                             reinterpret_cast<HeapObject*>(object));
+  }
+};
+
+
+// Copied objects shared by threads scavenging in parallel.  A thread with
+// many objects to scan moves some of them to the pool when another thread
+// is idle, idle threads wait in Take until there are objects or all threads
+// are idle (copying is done).
+class ScavengeWorkPool {
+ public:
+  static const int kChunkSize = 64;
+
+  explicit ScavengeWorkPool(int threads)
+      : mutex_(OS::CreateMutex()), threads_(threads), idle_(0), done_(false) {
+  }
+
+  ~ScavengeWorkPool() {
+    ASSERT(objects_.is_empty());
+    delete mutex_;
+  }
+
+  bool IsHungry() { return idle_ > 0; }
+
+  void Share(ScavengeContext* context, int count) {
+    ScopedLock lock(mutex_);
+    for (int i = 0; i < count && !context->IsEmpty(); i++) {
+      objects_.Add(context->Pop());
+    }
+  }
+
+  // Refills the context, returns false when copying is done.
+  bool Take(ScavengeContext* context) {
+    ASSERT(context->IsEmpty());
+    mutex_->Lock();
+    idle_++;
+    while (objects_.is_empty() && !done_) {
+      if (idle_ == threads_) {
+        done_ = true;
+        break;
+      }
+      mutex_->Unlock();
+      Thread::YieldCPU();
+      mutex_->Lock();
+    }
+    if (done_) {
+      mutex_->Unlock();
+      return false;
+    }
+    idle_--;
+    for (int i = 0; i < kChunkSize && !objects_.is_empty(); i++) {
+      context->Push(objects_.RemoveLast());
+    }
+    mutex_->Unlock();
+    return true;
+  }
+
+ private:
+  Mutex* mutex_;
+  List<HeapObject*> objects_;
+  int threads_;
+  volatile int idle_;
+  bool done_;
+};
+
+
+// Runs in the GC thread, which scans the objects copied from the roots, and
+// in threads paused for GC, which start idle.
+class ParallelScavengeTask : public GCTask {
+ public:
+  ParallelScavengeTask(Heap* heap, ScavengeWorkPool* pool)
+      : heap_(heap), pool_(pool) { }
+
+  virtual void Run() {
+    int thread = Heap::ThreadIndex();
+    if (heap_->scavenge_contexts_[thread] == NULL) {
+      heap_->scavenge_contexts_[thread] = new ScavengeContext(heap_);
+    }
+    ScavengeContext* context = heap_->scavenge_contexts_[thread];
+    do {
+      while (!context->IsEmpty()) {
+        if (pool_->IsHungry() &&
+            context->length() >= 2 * ScavengeWorkPool::kChunkSize) {
+          pool_->Share(context, ScavengeWorkPool::kChunkSize);
+        }
+
+        HeapObject* object = context->Pop();
+        if (heap_->InNewSpace(object)) {
+          ParallelNewSpaceScavenger::IterateBody(object->map(), object);
+        } else {
+          ScavengePromotedObject(context, object);
+        }
+      }
+    } while (pool_->Take(context));
+  }
+
+ private:
+  // Like IterateAndMarkPointersToFromSpace, slots that still point to new
+  // space are recorded by the thread.
+  void ScavengePromotedObject(ScavengeContext* context, HeapObject* object) {
+    ASSERT(!object->IsMap());
+    Address slot_address = object->address();
+    Address end = slot_address + object->Size();
+    while (slot_address < end) {
+      Object** slot = reinterpret_cast<Object**>(slot_address);
+      Object* value = *slot;
+      if (value->IsHeapObject() && heap_->InFromSpace(value)) {
+        ScavengeObjectInParallel(reinterpret_cast<HeapObject**>(slot),
+                                 HeapObject::cast(value));
+        if (heap_->InNewSpace(*slot)) {
+          context->RecordSlot(slot_address);
+        }
+      }
+      slot_address += kPointerSize;
+    }
+  }
+
+  Heap* heap_;
+  ScavengeWorkPool* pool_;
+};
+
+
+bool Heap::CanScavengeInParallel() {
+  // Marks are not transferred and profiler and logger events of moved
+  // objects are not thread-safe.
+  if (!FLAG_parallel_scavenge || incremental_marking()->IsMarking()) {
+    return false;
+  }
+  if (isolate()->logger()->is_logging() ||
+      CpuProfiler::is_profiling(isolate())) {
+    return false;
+  }
+  HeapProfiler* profiler = isolate()->heap_profiler();
+  if (profiler != NULL && profiler->is_profiling()) return false;
+
+  return isolate()->stm()->GCHelpers() > 0;
+}
+
+
+void Heap::ScavengeInParallel() {
+  STM* stm = isolate()->stm();
+  int thread = ThreadIndex();
+  if (scavenge_contexts_[thread] == NULL) {
+    scavenge_contexts_[thread] = new ScavengeContext(this);
+  }
+
+  ParallelScavengeVisitor scavenge_visitor(this);
+  ScavengeRoots(&scavenge_visitor, &ScavengeObjectInParallel);
+  {
+    ScavengeWorkPool pool(stm->GCHelpers() + 1);
+    ParallelScavengeTask task(this, &pool);
+    stm->RunGCTask(&task);
+  }
+
+  isolate_->global_handles()->IdentifyNewSpaceWeakIndependentHandles(
+      &IsUnscavengedHeapObject);
+  isolate_->global_handles()->IterateNewSpaceWeakIndependentRoots(
+      &scavenge_visitor);
+  {
+    ScavengeWorkPool pool(stm->GCHelpers() + 1);
+    ParallelScavengeTask task(this, &pool);
+    stm->RunGCTask(&task);
+  }
+
+  // Promoted objects are scanned, see DoScavenge.
+  StoreBufferRebuildScope scope(this,
+                                store_buffer(),
+                                &ScavengeStoreBufferCallback);
+  for (int i = 0; i < MAX_THREADS; i++) {
+    if (scavenge_contexts_[i] != NULL) scavenge_contexts_[i]->Finish();
+  }
+}
+
+
 MaybeObject* Heap::AllocatePartialMap(InstanceType instance_type,
                                       int instance_size) {
   Object* result;
@@ -2091,7 +2561,7 @@ MaybeObject* Heap::AllocateHeapNumber(double value) {
   ASSERT(allocation_allowed() && gc_state_ == NOT_IN_GC);
 
   Object* result;
-  { MaybeObject* maybe_result = new_space_.AllocateRaw(HeapNumber::kSize);
+  { MaybeObject* maybe_result = AllocateRawInNewSpace(HeapNumber::kSize);
     if (!maybe_result->ToObject(&result)) return maybe_result;
   }
   HeapObject::cast(result)->set_map(heap_number_map());
@@ -3710,7 +4180,7 @@ MaybeObject* Heap::AllocateGlobalObject(JSFunction* constructor) {
 }
 
 
-MaybeObject* Heap::CopyJSObject(JSObject* source) {
+MaybeObject* Heap::CopyJSObjectShallow(JSObject* source) {
   // Never used to copy functions.  If functions need to be copied we
   // have to be careful to clear the literals array.
   ASSERT(!source->IsJSFunction());
@@ -3736,7 +4206,7 @@ MaybeObject* Heap::CopyJSObject(JSObject* source) {
                  JSObject::kHeaderSize,
                  (object_size - JSObject::kHeaderSize) / kPointerSize);
   } else {
-    { MaybeObject* maybe_clone = new_space_.AllocateRaw(object_size);
+    { MaybeObject* maybe_clone = AllocateRawInNewSpace(object_size);
       if (!maybe_clone->ToObject(&clone)) return maybe_clone;
     }
     ASSERT(InNewSpace(clone));
@@ -3748,6 +4218,16 @@ MaybeObject* Heap::CopyJSObject(JSObject* source) {
   }
 
   ASSERT(JSObject::cast(clone)->GetElementsKind() == source->GetElementsKind());
+  return clone;
+}
+
+
+MaybeObject* Heap::CopyJSObject(JSObject* source) {
+  Object* clone;
+  { MaybeObject* maybe_clone = CopyJSObjectShallow(source);
+    if (!maybe_clone->ToObject(&clone)) return maybe_clone;
+  }
+
   FixedArrayBase* elements = FixedArrayBase::cast(source->elements());
   FixedArray* properties = FixedArray::cast(source->properties());
   // Update elements if necessary.
@@ -4130,7 +4610,7 @@ MaybeObject* Heap::AllocateRawFixedArray(int length) {
   // Allocate the raw data for a fixed array.
   int size = FixedArray::SizeFor(length);
   return size <= kMaxObjectSizeInNewSpace
-      ? new_space_.AllocateRaw(size)
+      ? AllocateRawInNewSpace(size)
       : lo_space_->AllocateRaw(size, NOT_EXECUTABLE);
 }
 
@@ -4698,6 +5178,7 @@ void Heap::Verify() {
 
 
 MaybeObject* Heap::LookupSymbol(Vector<const char> string) {
+  SharedHeapScope shared_heap_scope(this);
   Object* symbol = NULL;
   Object* new_table;
   { MaybeObject* maybe_new_table =
@@ -4713,6 +5194,7 @@ MaybeObject* Heap::LookupSymbol(Vector<const char> string) {
 
 
 MaybeObject* Heap::LookupAsciiSymbol(Vector<const char> string) {
+  SharedHeapScope shared_heap_scope(this);
   Object* symbol = NULL;
   Object* new_table;
   { MaybeObject* maybe_new_table =
@@ -4730,6 +5212,7 @@ MaybeObject* Heap::LookupAsciiSymbol(Vector<const char> string) {
 MaybeObject* Heap::LookupAsciiSymbol(Handle<SeqAsciiString> string,
                                      int from,
                                      int length) {
+  SharedHeapScope shared_heap_scope(this);
   Object* symbol = NULL;
   Object* new_table;
   { MaybeObject* maybe_new_table =
@@ -4748,6 +5231,7 @@ MaybeObject* Heap::LookupAsciiSymbol(Handle<SeqAsciiString> string,
 
 
 MaybeObject* Heap::LookupTwoByteSymbol(Vector<const uc16> string) {
+  SharedHeapScope shared_heap_scope(this);
   Object* symbol = NULL;
   Object* new_table;
   { MaybeObject* maybe_new_table =
@@ -4764,6 +5248,7 @@ MaybeObject* Heap::LookupTwoByteSymbol(Vector<const uc16> string) {
 
 MaybeObject* Heap::LookupSymbol(String* string) {
   if (string->IsSymbol()) return string;
+  SharedHeapScope shared_heap_scope(this);
   Object* symbol = NULL;
   Object* new_table;
   { MaybeObject* maybe_new_table =
@@ -5117,6 +5602,19 @@ bool Heap::ConfigureHeap(int max_semispace_size,
     max_semispace_size_ = max_semispace_size;
   }
 
+  if (FLAG_stm && FLAG_threads > 1) {
+    // Worker threads share the new space, so give each of them the default
+    // nursery between scavenges. Scavenges stop all workers and their cost
+    // depends on survivors, not on the amount of garbage.  With a snapshot
+    // the reservation cannot grow (see below), so only the initial size
+    // grows up to the default maximum.
+    initial_semispace_size_ =
+        RoundUpToPowerOf2(initial_semispace_size_ * FLAG_threads);
+    if (max_semispace_size <= 0 && !Snapshot::IsEnabled()) {
+      max_semispace_size_ *= FLAG_threads;
+    }
+  }
+
   if (Snapshot::IsEnabled()) {
     // If we are using a snapshot we always reserve the default amount
     // of memory for each semispace because code in the snapshot has
@@ -5416,6 +5914,7 @@ bool Heap::Setup(bool create_heap_objects) {
       initialized_gc = true;
       InitializeScavengingVisitorsTables();
       NewSpaceScavenger::Initialize();
+      ParallelNewSpaceScavenger::Initialize();
       MarkCompactCollector::Initialize();
   }
   gc_initializer_mutex->Unlock();
@@ -5572,14 +6071,19 @@ void Heap::SetStackLimits() {
   // On 64 bit machines, pointers are generally out of range of Smis.  We write
   // something that looks like an out of range Smi to the GC.
 
+  SetStackLimits(ThreadIndex(), isolate_->stack_guard());
+}
+
+
+void Heap::SetStackLimits(int thread_index, StackGuard* stack_guard) {
   // Set up the special root array entries containing the stack limits.
   // These are actually addresses, but the tag makes the GC ignore it.
-  thread_roots()[kStackLimitRootIndex] =
+  thread_roots_[thread_index][kStackLimitRootIndex] =
       reinterpret_cast<Object*>(
-          (isolate_->stack_guard()->jslimit() & ~kSmiTagMask) | kSmiTag);
-  thread_roots()[kRealStackLimitRootIndex] =
+          (stack_guard->jslimit() & ~kSmiTagMask) | kSmiTag);
+  thread_roots_[thread_index][kRealStackLimitRootIndex] =
       reinterpret_cast<Object*>(
-          (isolate_->stack_guard()->real_jslimit() & ~kSmiTagMask) | kSmiTag);
+          (stack_guard->real_jslimit() & ~kSmiTagMask) | kSmiTag);
 }
 
 
@@ -5595,6 +6099,8 @@ void Heap::TearDown() {
     PrintF("\n\n");
   }
 
+  mark_compact_collector()->StopConcurrentSweeping();
+
   isolate_->global_handles()->TearDown();
 
   external_string_table_.TearDown();
@@ -5640,8 +6146,16 @@ void Heap::TearDown() {
   store_buffer()->TearDown();
   incremental_marking()->TearDown();
 
+  for (int thread = 0; thread < MAX_THREADS; thread++) {
+    delete scavenge_contexts_[thread];
+    scavenge_contexts_[thread] = NULL;
+  }
+
   isolate_->memory_allocator()->TearDown();
 
+  delete shared_heap_mutex_;
+  shared_heap_mutex_ = NULL;
+
 #ifdef DEBUG
   delete debug_utils_;
   debug_utils_ = NULL;
@@ -5649,6 +6163,65 @@ void Heap::TearDown() {
 }
 
 
+MaybeObject* Heap::RefillLocalAllocationBuffer(int size_in_bytes,
+                                               AllocationSpace space) {
+  ASSERT(FLAG_stm && space < kLocalAllocationSpaces);
+  PagedSpace* paged_space = (space == OLD_POINTER_SPACE)
+      ? static_cast<PagedSpace*>(old_pointer_space_)
+      : static_cast<PagedSpace*>(old_data_space_);
+
+  // Big objects would waste most of a buffer.
+  if (size_in_bytes > kMaxLocalAllocationSize) {
+    return (space == NEW_SPACE)
+        ? new_space_.AllocateRaw(size_in_bytes)
+        : paged_space->AllocateRaw(size_in_bytes);
+  }
+
+  AllocationInfo* buffer = &local_allocation_buffers_[ThreadIndex()][space];
+  Address top = buffer->top;
+  ReleaseLocalAllocationBuffer(buffer);
+
+  MaybeObject* maybe_result = (space == NEW_SPACE)
+      ? new_space_.AllocateRaw(kLocalAllocationBufferSize)
+      : paged_space->AllocateRaw(kLocalAllocationBufferSize);
+  Object* result;
+  if (!maybe_result->ToObject(&result)) {
+    // The space may still have room for the object itself.
+    if (space == NEW_SPACE) isolate_->stm()->SwitchAllocationBuffer(top, NULL);
+    return (space == NEW_SPACE)
+        ? new_space_.AllocateRaw(size_in_bytes)
+        : paged_space->AllocateRaw(size_in_bytes);
+  }
+
+  Address start = HeapObject::cast(result)->address();
+  buffer->top = start + size_in_bytes;
+  buffer->limit = start + kLocalAllocationBufferSize;
+  // Transactions track their objects in new space.
+  if (space == NEW_SPACE) isolate_->stm()->SwitchAllocationBuffer(top, start);
+  return result;
+}
+
+
+void Heap::ReleaseLocalAllocationBuffer(AllocationInfo* buffer) {
+  if (buffer->top != NULL && buffer->top < buffer->limit) {
+    CreateFillerObjectAt(buffer->top,
+                         static_cast<int>(buffer->limit - buffer->top));
+  }
+  buffer->top = NULL;
+  buffer->limit = NULL;
+}
+
+
+void Heap::ReleaseLocalAllocationBuffers() {
+  // Other threads are paused, they don't touch their buffers.
+  for (int thread = 0; thread < MAX_THREADS; thread++) {
+    for (int space = 0; space < kLocalAllocationSpaces; space++) {
+      ReleaseLocalAllocationBuffer(&local_allocation_buffers_[thread][space]);
+    }
+  }
+}
+
+
 void Heap::Shrink() {
   // Try to shrink all paged spaces.
   PagedSpaces spaces;
@@ -6471,7 +7044,8 @@ CollectionScope::CollectionScope() {
 }
 
 CollectionScope::~CollectionScope() {
-  HEAP->isolate()->stm()->LeaveCollectionScope();
+  // Collection done by another thread was left by that thread.
+  if (!skip_) HEAP->isolate()->stm()->LeaveCollectionScope();
 }
 
 void Heap::QueueMemoryChunkForFree(MemoryChunk* chunk) {
@@ -242,6 +242,8 @@ inline Heap* _inline_get_heap_();
 class GCTracer;
 class HeapStats;
 class Isolate;
+class ScavengeContext;
+class StackGuard;
 class WeakObjectRetainer;
 
 
@@ -390,6 +392,8 @@ class Heap {
   // code that looks here, because it is faster than loading from the static
   // jslimit_/real_jslimit_ variable in the StackGuard.
   void SetStackLimits();
+  // Same for other thread, given its stack guard.
+  void SetStackLimits(int thread_index, StackGuard* stack_guard);
 
   // Returns whether Setup has been called.
   bool HasBeenSetup();
@@ -434,7 +438,13 @@ class Heap {
   // for all addresses in either semispace.
   Address NewSpaceStart() { return new_space_.start(); }
   uintptr_t NewSpaceMask() { return new_space_.mask(); }
-  Address NewSpaceTop() { return new_space_.top(); }
+  // Under STM each thread allocates from its own buffer.
+  Address NewSpaceTop() {
+    if (FLAG_stm) {
+      return local_allocation_buffers_[ThreadIndex()][NEW_SPACE].top;
+    }
+    return new_space_.top();
+  }
 
   NewSpace* new_space() { return &new_space_; }
   OldSpace* old_pointer_space() { return old_pointer_space_; }
@@ -481,6 +491,11 @@ class Heap {
   // Returns failure if allocation failed.
   MUST_USE_RESULT MaybeObject* CopyJSObject(JSObject* source);
 
+  // Returns a shallow copy of the JavaScript object, properties and elements
+  // are shared with the source.
+  // Returns failure if allocation failed.
+  MUST_USE_RESULT MaybeObject* CopyJSObjectShallow(JSObject* source);
+
   // Allocates the function prototype.
   // Returns Failure::RetryAfterGC(requested_bytes, space) if the allocation
   // failed.
@@ -863,6 +878,14 @@ class Heap {
                                                   AllocationSpace space,
                                                   AllocationSpace retry_space);
 
+  // Allocates an uninitialized object in new space without falling back to
+  // old spaces.
+  MUST_USE_RESULT inline MaybeObject* AllocateRawInNewSpace(int size_in_bytes);
+
+  // Protects the state shared by threads running transactions (--stm), see
+  // SharedHeapScope.
+  Mutex* shared_heap_mutex() { return shared_heap_mutex_; }
+
   // Initialize a filler object to keep the ability to iterate over the heap
   // when shortening objects.
   void CreateFillerObjectAt(Address addr, int size);
@@ -1112,6 +1135,9 @@ class Heap {
   // Update the next script id.
   inline void SetLastScriptId(Object* last_script_id);
 
+  // Index of the current thread in per-thread root lists.
+  static int ThreadIndex();
+
   // Generated code can embed this address to get access to the roots.
   Object** roots_address() { return roots_; }
   Object** thread_roots_address() { return thread_roots_[ThreadIndex()]; }
@@ -1454,6 +1480,12 @@ class Heap {
     scavenging_visitors_table_.GetVisitor(map)(map, slot, obj);
   }
 
+  // Buffers and copied objects of the current thread in a scavenge with
+  // threads paused for GC (see ScavengeInParallel).
+  ScavengeContext* scavenge_context() {
+    return scavenge_contexts_[ThreadIndex()];
+  }
+
   void QueueMemoryChunkForFree(MemoryChunk* chunk);
   void FreeQueuedChunks();
 
@@ -1464,8 +1496,6 @@ class Heap {
  private:
   Heap();
 
-  static int ThreadIndex();
-
   // This can be calculated directly from a pointer to the heap; however, it is
   // more expedient to get at the isolate directly from within Heap methods.
   Isolate* isolate_;
@@ -1585,6 +1615,13 @@ class Heap {
   Object* roots_[kRootListLength];
   Object* thread_roots_[MAX_THREADS][kThreadRootListLength];
 
+  // Linear allocation buffers of threads, see AllocateRawLocal.
+  static const int kLocalAllocationBufferSize = 32 * KB;
+  static const int kMaxLocalAllocationSize = kLocalAllocationBufferSize / 4;
+  static const int kLocalAllocationSpaces = OLD_DATA_SPACE + 1;
+  AllocationInfo local_allocation_buffers_[MAX_THREADS][kLocalAllocationSpaces];
+  Mutex* shared_heap_mutex_;
+
   Object* global_contexts_list_;
 
   StoreBufferRebuilder store_buffer_rebuilder_;
@@ -1666,6 +1703,21 @@ class Heap {
   inline void UpdateOldSpaceLimits();
 
 
+  // Threads running transactions (--stm) allocate in new space and old
+  // spaces from their own linear allocation buffers without locking.  When
+  // a buffer is exhausted the next one is carved out of the shared space,
+  // objects too big for a buffer and objects in other spaces are allocated
+  // from the shared spaces directly, both under the shared heap mutex.
+  // Buffers are given back at the beginning of each GC, their unused parts
+  // become filler objects.
+  MUST_USE_RESULT inline MaybeObject* AllocateRawLocal(int size_in_bytes,
+                                                       AllocationSpace space);
+  MUST_USE_RESULT MaybeObject* RefillLocalAllocationBuffer(
+      int size_in_bytes,
+      AllocationSpace space);
+  void ReleaseLocalAllocationBuffer(AllocationInfo* buffer);
+  void ReleaseLocalAllocationBuffers();
+
   // Allocate an uninitialized object in map space.  The behavior is identical
   // to Heap::AllocateRaw(size_in_bytes, MAP_SPACE), except that (a) it doesn't
   // have to test the allocation space argument and (b) can reduce code size
@@ -1708,6 +1760,15 @@ class Heap {
       Object** pointer);
 
   Address DoScavenge(ObjectVisitor* scavenge_visitor, Address new_space_front);
+
+  // Copies objects referenced by roots, by the old generation and by cells.
+  void ScavengeRoots(ObjectVisitor* scavenge_visitor,
+                     ObjectSlotCallback scavenge_callback);
+
+  // Threads paused for GC help the scavenge with copying objects reachable
+  // from the roots (the roots are copied by the GC thread).
+  bool CanScavengeInParallel();
+  void ScavengeInParallel();
   static void ScavengeStoreBufferCallback(Heap* heap,
                                           MemoryChunk* page,
                                           StoreBufferEvent event);
@@ -1796,7 +1857,7 @@ class Heap {
     return high_survival_rate_period_length_ > 0;
   }
 
-  void SelectScavengingVisitorsTable();
+  void SelectScavengingVisitorsTable(bool in_parallel);
 
   static const int kInitialSymbolTableSize = 2048;
   static const int kInitialEvalCacheSize = 64;
@@ -1838,6 +1899,9 @@ class Heap {
 
   VisitorDispatchTable<ScavengingCallback> scavenging_visitors_table_;
 
+  // Created by the first parallel scavenge in each thread.
+  ScavengeContext* scavenge_contexts_[MAX_THREADS];
+
   MemoryChunk* chunks_queued_for_free_;
 
   friend class Factory;
@@ -1850,6 +1914,7 @@ class Heap {
   friend class MarkCompactCollector;
   friend class StaticMarkingVisitor;
   friend class MapCompact;
+  friend class ParallelScavengeTask;
 
   DISALLOW_COPY_AND_ASSIGN(Heap);
 };
@@ -1888,6 +1953,30 @@ class HeapStats {
 };
 
 
+// Serializes modifications of the heap state shared by threads running
+// transactions (--stm): allocation in the shared spaces, insertion into
+// the symbol table, the compilation cache and map caches, and inline cache
+// updates.  The mutex is recursive, so the scopes may nest.  A scope must
+// not span a GC pause (AllocationScope), otherwise GC would wait for threads
+// blocked on the mutex.
+class SharedHeapScope {
+ public:
+  explicit SharedHeapScope(Heap* heap)
+      : mutex_(FLAG_stm ? heap->shared_heap_mutex() : NULL) {
+    if (mutex_ != NULL) mutex_->Lock();
+  }
+
+  ~SharedHeapScope() {
+    if (mutex_ != NULL) mutex_->Unlock();
+  }
+
+ private:
+  Mutex* mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedHeapScope);
+};
+
+
 class AlwaysAllocateScope {
  public:
   AlwaysAllocateScope() {
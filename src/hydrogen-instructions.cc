@@ -1377,6 +1377,12 @@ void HLoadNamedField::PrintDataTo(StringStream* stream) {
 }
 
 
+void HSTMBarrier::PrintDataTo(StringStream* stream) {
+  object()->PrintNameTo(stream);
+  stream->Add(" %s slot %d", is_store() ? "store" : "load", slot());
+}
+
+
 HLoadNamedFieldPolymorphic::HLoadNamedFieldPolymorphic(HValue* context,
                                                        HValue* object,
                                                        SmallMapList* types,
@@ -153,6 +153,7 @@ class LChunkBuilder;
   V(Simulate)                                  \
   V(SoftDeoptimize)                            \
   V(StackCheck)                                \
+  V(STMBarrier)                                \
   V(StoreContextSlot)                          \
   V(StoreGlobalCell)                           \
   V(StoreGlobalGeneric)                        \
@@ -3392,6 +3393,49 @@ class HStoreContextSlot: public HTemplateInstruction<2> {
 };
 
 
+// Redirects an object to the object the current STM transaction works with
+// (the original or the transaction's copy) before a field of it is accessed,
+// see STM::LoadBarrier.  Deoptimizes when the access needs the runtime, for
+// example to copy the object on its first store.  Load barriers depend on
+// field stores, so GVN removes repeated ones and hoists them out of loops
+// that don't store.  Store barriers don't participate in GVN, they are
+// always followed by the field store which kills the load barriers.
+class HSTMBarrier: public HUnaryOperation {
+ public:
+  HSTMBarrier(HValue* object, int slot, bool is_store)
+      : HUnaryOperation(object), slot_(slot), is_store_(is_store) {
+    set_representation(Representation::Tagged());
+    if (!is_store) {
+      SetFlag(kUseGVN);
+      SetFlag(kDependsOnInobjectFields);
+      SetFlag(kDependsOnBackingStoreFields);
+      SetFlag(kDependsOnMaps);
+    }
+  }
+
+  HValue* object() { return value(); }
+  int slot() const { return slot_; }
+  bool is_store() const { return is_store_; }
+
+  virtual Representation RequiredInputRepresentation(int index) {
+    return Representation::Tagged();
+  }
+  virtual void PrintDataTo(StringStream* stream);
+
+  DECLARE_CONCRETE_INSTRUCTION(STMBarrier)
+
+ protected:
+  virtual bool DataEquals(HValue* other) {
+    HSTMBarrier* b = HSTMBarrier::cast(other);
+    return slot_ == b->slot() && is_store_ == b->is_store();
+  }
+
+ private:
+  int slot_;
+  bool is_store_;
+};
+
+
 class HLoadNamedField: public HUnaryOperation {
  public:
   HLoadNamedField(HValue* object, bool is_in_object, int offset)
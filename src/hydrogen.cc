@@ -35,6 +35,7 @@
 #include "parser.h"
 #include "scopeinfo.h"
 #include "scopes.h"
+#include "stm.h"
 #include "stub-cache.h"
 
 #if V8_TARGET_ARCH_IA32
@@ -1297,6 +1298,62 @@ void HStackCheckEliminator::Process() {
 }
 
 
+class HSTMBarrierEliminator BASE_EMBEDDED {
+ public:
+  explicit HSTMBarrierEliminator(HGraph* graph) : graph_(graph) { }
+
+  void Process();
+
+ private:
+  HGraph* graph_;
+};
+
+
+void HSTMBarrierEliminator::Process() {
+  // Store barriers are not numbered by GVN (see HSTMBarrier), so a store
+  // barrier is replaced here by an identical one that precedes it on every
+  // path.  Only chains of blocks with a single predecessor are followed and
+  // anything that may change maps (calls, transitions) ends the chain,
+  // because the copy of the object may not match the checked map anymore.
+  ZoneList<ZoneList<HSTMBarrier*>*> available(graph_->blocks()->length());
+  for (int i = 0; i < graph_->blocks()->length(); i++) {
+    HBasicBlock* block = graph_->blocks()->at(i);
+    ZoneList<HSTMBarrier*>* barriers = new ZoneList<HSTMBarrier*>(2);
+    if (block->predecessors()->length() == 1 && !block->IsLoopHeader()) {
+      // Blocks are in reverse postorder, the predecessor is done.
+      HBasicBlock* predecessor = block->predecessors()->at(0);
+      barriers->AddAll(*available[predecessor->block_id()]);
+    }
+
+    HInstruction* instr = block->first();
+    while (instr != NULL) {
+      HInstruction* next = instr->next();
+      if (instr->CheckFlag(HValue::kChangesMaps)) {
+        barriers->Rewind(0);
+      } else if (instr->IsSTMBarrier() &&
+                 HSTMBarrier::cast(instr)->is_store()) {
+        HSTMBarrier* barrier = HSTMBarrier::cast(instr);
+        HSTMBarrier* other = NULL;
+        for (int j = 0; j < barriers->length(); j++) {
+          if (barriers->at(j)->object() == barrier->object() &&
+              barriers->at(j)->slot() == barrier->slot()) {
+            other = barriers->at(j);
+            break;
+          }
+        }
+        if (other != NULL) {
+          barrier->DeleteAndReplaceWith(other);
+        } else {
+          barriers->Add(barrier);
+        }
+      }
+      instr = next;
+    }
+    available.Add(barriers);
+  }
+}
+
+
 // Simple sparse set with O(1) add, contains, and clear.
 class SparseSet {
  public:
@@ -2373,6 +2430,11 @@ HGraph* HGraphBuilder::CreateGraph() {
   }
   graph()->ComputeMinusZeroChecks();
 
+  if (FLAG_stm) {
+    HSTMBarrierEliminator sbe(graph());
+    sbe.Process();
+  }
+
   // Eliminate redundant stack checks on backwards branches.
   HStackCheckEliminator sce(graph());
   sce.Process();
@@ -3107,7 +3169,9 @@ void HGraphBuilder::VisitConditional(Conditional* expr) {
 
 HGraphBuilder::GlobalPropertyAccess HGraphBuilder::LookupGlobalProperty(
     Variable* var, LookupResult* lookup, bool is_store) {
-  if (var->is_this() || !info()->has_global_object()) {
+  // Transactions redirect the global object to their copy, cells are
+  // accessed directly.
+  if (var->is_this() || !info()->has_global_object() || FLAG_stm) {
     return kUseGeneric;
   }
   Handle<GlobalObject> global(info()->global_object());
@@ -3430,6 +3494,13 @@ HInstruction* HGraphBuilder::BuildStoreNamedField(HValue* object,
   }
 
   int index = ComputeStoredFieldIndex(type, name, lookup);
+  if (FLAG_stm) {
+    // Transition changes the layout of the whole object.
+    int slot = lookup->type() == MAP_TRANSITION
+        ? STM::kTransitionSlot
+        : index + type->inobject_properties();
+    object = AddSTMBarrier(object, slot, true);
+  }
   bool is_in_object = index < 0;
   int offset = index * kPointerSize;
   if (index < 0) {
@@ -3916,6 +3987,9 @@ HLoadNamedField* HGraphBuilder::BuildLoadNamedField(HValue* object,
   }
 
   int index = lookup->GetLocalFieldIndexFromMap(*type);
+  if (FLAG_stm) {
+    object = AddSTMBarrier(object, index + type->inobject_properties(), false);
+  }
   if (index < 0) {
     // Negative property indices are in-object properties, indexed
     // from the end of the fixed part of the object.
@@ -3929,6 +4003,12 @@ HLoadNamedField* HGraphBuilder::BuildLoadNamedField(HValue* object,
 }
 
 
+HValue* HGraphBuilder::AddSTMBarrier(HValue* object, int slot, bool is_store) {
+  if (!FLAG_stm) return object;
+  return AddInstruction(new(zone()) HSTMBarrier(object, slot, is_store));
+}
+
+
 HInstruction* HGraphBuilder::BuildLoadNamedGeneric(HValue* obj,
                                                    Property* expr) {
   ASSERT(expr->key()->IsPropertyName());
@@ -3950,7 +4030,9 @@ HInstruction* HGraphBuilder::BuildLoadNamed(HValue* obj,
                                map,
                                &lookup,
                                true);
-  } else if (lookup.IsProperty() && lookup.type() == CONSTANT_FUNCTION) {
+  } else if (lookup.IsProperty() && lookup.type() == CONSTANT_FUNCTION &&
+             !FLAG_stm) {
+    // The copy of a transaction may have redefined the function.
     AddInstruction(new(zone()) HCheckNonSmi(obj));
     AddInstruction(new(zone()) HCheckMap(obj, map));
     Handle<JSFunction> function(lookup.GetConstantFunctionFromMap(*map));
@@ -4244,9 +4326,12 @@ HValue* HGraphBuilder::HandleKeyedElementAccess(HValue* obj,
                                                 bool* has_side_effects) {
   ASSERT(!expr->IsPropertyName());
   HInstruction* instr = NULL;
-  if (expr->IsMonomorphic()) {
+  // Elements have no STM barriers, the generic stubs go through the
+  // runtime under STM.
+  if (expr->IsMonomorphic() && !FLAG_stm) {
     instr = BuildMonomorphicElementAccess(obj, key, val, expr, is_store);
-  } else if (expr->GetReceiverTypes() != NULL &&
+  } else if (!FLAG_stm &&
+             expr->GetReceiverTypes() != NULL &&
              !expr->GetReceiverTypes()->is_empty()) {
     return HandlePolymorphicElementAccess(
         obj, key, val, expr, ast_id, position, is_store, has_side_effects);
@@ -4326,7 +4411,7 @@ void HGraphBuilder::VisitProperty(Property* expr) {
   CHECK_ALIVE(VisitForValue(expr->obj()));
 
   HInstruction* instr = NULL;
-  if (expr->IsArrayLength()) {
+  if (expr->IsArrayLength() && !FLAG_stm) {
     HValue* array = Pop();
     AddInstruction(new(zone()) HCheckNonSmi(array));
     HInstruction* mapcheck =
@@ -4360,7 +4445,7 @@ void HGraphBuilder::VisitProperty(Property* expr) {
     HValue* obj = Pop();
     if (expr->IsMonomorphic()) {
       instr = BuildLoadNamed(obj, expr, types->first(), name);
-    } else if (types != NULL && types->length() > 1) {
+    } else if (types != NULL && types->length() > 1 && !FLAG_stm) {
       AddInstruction(new(zone()) HCheckNonSmi(obj));
       HValue* context = environment()->LookupContext();
       instr = new(zone()) HLoadNamedFieldPolymorphic(context, obj, types, name);
@@ -928,6 +928,9 @@ class HGraphBuilder: public AstVisitor {
                                      HValue* right);
   HInstruction* BuildIncrement(bool returns_original_input,
                                CountOperation* expr);
+  // Returns the object the current STM transaction works with, or the
+  // object itself when STM is off.
+  HValue* AddSTMBarrier(HValue* object, int slot, bool is_store);
   HLoadNamedField* BuildLoadNamedField(HValue* object,
                                        Property* expr,
                                        Handle<Map> type,
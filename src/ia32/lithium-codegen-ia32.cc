@@ -4446,6 +4446,27 @@ void LCodeGen::DoStackCheck(LStackCheck* instr) {
 }
 
 
+void LCodeGen::DoSTMBarrier(LSTMBarrier* instr) {
+  ASSERT(ToRegister(instr->object()).is(eax));
+  ASSERT(ToRegister(instr->result()).is(eax));
+  // The barrier function neither allocates nor throws, when it fails the
+  // unoptimized code does the access through the runtime.  It is safe to use
+  // ebx directly since the instruction is marked as a call.
+  __ PrepareCallCFunction(3, ebx);
+  __ mov(Operand(esp, 0 * kPointerSize),
+         Immediate(ExternalReference::isolate_address()));
+  __ mov(Operand(esp, 1 * kPointerSize), eax);
+  __ mov(Operand(esp, 2 * kPointerSize),
+         Immediate(instr->hydrogen()->slot()));
+  __ CallCFunction(instr->hydrogen()->is_store()
+      ? ExternalReference::stm_store_barrier_function(isolate())
+      : ExternalReference::stm_load_barrier_function(isolate()),
+      3);
+  __ test(eax, Operand(eax));
+  DeoptimizeIf(zero, instr->environment());
+}
+
+
 void LCodeGen::DoOsrEntry(LOsrEntry* instr) {
   // This is a pseudo-instruction that ensures that the environment here is
   // properly registered for deoptimization and records the assembler's PC
@@ -2253,6 +2253,13 @@ LInstruction* LChunkBuilder::DoStackCheck(HStackCheck* instr) {
 }
 
 
+LInstruction* LChunkBuilder::DoSTMBarrier(HSTMBarrier* instr) {
+  LOperand* object = UseFixed(instr->object(), eax);
+  LSTMBarrier* result = new LSTMBarrier(object);
+  return MarkAsCall(DefineFixed(result, eax), instr, CAN_DEOPTIMIZE_EAGERLY);
+}
+
+
 LInstruction* LChunkBuilder::DoEnterInlined(HEnterInlined* instr) {
   HEnvironment* outer = current_block_->last_environment();
   HConstant* undefined = graph()->GetConstantUndefined();
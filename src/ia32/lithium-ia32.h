@@ -138,6 +138,7 @@ class LCodeGen;
   V(SmiTag)                                     \
   V(SmiUntag)                                   \
   V(StackCheck)                                 \
+  V(STMBarrier)                                 \
   V(StoreContextSlot)                           \
   V(StoreGlobalCell)                            \
   V(StoreGlobalGeneric)                         \
@@ -2050,6 +2051,19 @@ class LStackCheck: public LTemplateInstruction<0, 1, 0> {
 };
 
 
+class LSTMBarrier: public LTemplateInstruction<1, 1, 0> {
+ public:
+  explicit LSTMBarrier(LOperand* object) {
+    inputs_[0] = object;
+  }
+
+  LOperand* object() { return inputs_[0]; }
+
+  DECLARE_CONCRETE_INSTRUCTION(STMBarrier, "stm-barrier")
+  DECLARE_HYDROGEN_ACCESSOR(STMBarrier)
+};
+
+
 class LIn: public LTemplateInstruction<1, 3, 0> {
  public:
   LIn(LOperand* context, LOperand* key, LOperand* object) {
@@ -726,6 +726,44 @@ void StubCompiler::GenerateKeyedLoadMissForceGeneric(MacroAssembler* masm) {
 }
 
 
+void StubCompiler::GenerateSTMBarrier(MacroAssembler* masm,
+                                      Register object,
+                                      int slot,
+                                      bool is_store,
+                                      Label* miss_label) {
+  if (!FLAG_stm) return;
+  ASSERT(!object.is(esp));
+
+  // Stubs are shared by threads, so transaction of the current thread is
+  // looked up by the barrier function. It neither allocates nor throws.
+  Label failed, done;
+  __ pushad();
+  __ mov(ebx, object);
+  AllowExternalCallThatCantCauseGC scope(masm);
+  __ PrepareCallCFunction(3, eax);
+  __ mov(Operand(esp, 0 * kPointerSize),
+         Immediate(ExternalReference::isolate_address()));
+  __ mov(Operand(esp, 1 * kPointerSize), ebx);
+  __ mov(Operand(esp, 2 * kPointerSize), Immediate(slot));
+  __ CallCFunction(is_store
+      ? ExternalReference::stm_store_barrier_function(masm->isolate())
+      : ExternalReference::stm_load_barrier_function(masm->isolate()),
+      3);
+  __ test(eax, eax);
+  __ j(zero, &failed);
+
+  // Replace the saved register, pushad stores eax first and edi last.
+  __ mov(Operand(esp, (7 - object.code()) * kPointerSize), eax);
+  __ popad();
+  __ jmp(&done);
+
+  __ bind(&failed);
+  __ popad();
+  __ jmp(miss_label);
+  __ bind(&done);
+}
+
+
 // Both name_reg and receiver_reg are preserved on jumps to miss_label,
 // but may be destroyed if store is successful.
 void StubCompiler::GenerateStoreField(MacroAssembler* masm,
@@ -753,6 +791,13 @@ void StubCompiler::GenerateStoreField(MacroAssembler* masm,
   // checks.
   ASSERT(object->IsJSGlobalProxy() || !object->IsAccessCheckNeeded());
 
+  // Store to the copy of the current transaction.
+  GenerateSTMBarrier(masm,
+                     receiver_reg,
+                     transition != NULL ? STM::kTransitionSlot : index,
+                     true,
+                     miss_label);
+
   // Perform map transition for the receiver if necessary.
   if ((transition != NULL) && (object->map()->unused_property_fields() == 0)) {
     // The properties must be extended before we can store the value.
@@ -1033,6 +1078,11 @@ void StubCompiler::GenerateLoadField(JSObject* object,
       CheckPrototypes(object, receiver, holder,
                       scratch1, scratch2, scratch3, name, miss);
 
+  // Load from the copy of the current transaction, the holder is the
+  // receiver under STM (see LoadIC::UpdateCaches).
+  ASSERT(!FLAG_stm || object == holder);
+  GenerateSTMBarrier(masm(), reg, index, false, miss);
+
   // Get the value from the properties.
   GenerateFastPropertyLoad(masm(), eax, reg, holder, index);
   __ ret(0);
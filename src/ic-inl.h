@@ -86,6 +86,8 @@ void IC::SetTargetAtAddress(Address address, Code* target) {
     ASSERT(old_target->extra_ic_state() == target->extra_ic_state());
   }
 #endif
+  // Call sites in shared code are patched by all threads (--stm).
+  SharedHeapScope shared_heap_scope(target->GetHeap());
   Assembler::set_target_address_at(address, target->instruction_start());
   target->GetHeap()->incremental_marking()->RecordCodeTargetPatch(address,
                                                                   target);
@@ -39,6 +39,14 @@
 namespace v8 {
 namespace internal {
 
+// Transactions redirect objects to their copies. Only named field stubs
+// have STM barriers (see StubCompiler::GenerateSTMBarrier), other stubs
+// would access the original objects, so their ICs keep calling the runtime.
+static bool UseICWithoutBarriers() {
+  return FLAG_use_ic && !FLAG_stm;
+}
+
+
 #ifdef DEBUG
 static char TransitionMarkFromState(IC::State state) {
   switch (state) {
@@ -455,7 +463,8 @@ MaybeObject* CallICBase::LoadFunction(State state,
                                       Handle<Object> objectGiven,
                                       Handle<String> name) {
   bool terminate = false;
-  Handle<Object> object = isolate()->stm()->RedirectLoad(objectGiven, &terminate);
+  Handle<Object> object =
+      isolate()->stm()->RedirectLoad(objectGiven, name, &terminate);
   if (terminate) return isolate()->TerminateExecution();
 
   // If the object is undefined or null it's illegal to try to get any
@@ -496,7 +505,7 @@ MaybeObject* CallICBase::LoadFunction(State state,
   }
 
   // Lookup is valid: Update inline cache and stub cache.
-  if (FLAG_use_ic) {
+  if (UseICWithoutBarriers()) {
     UpdateCaches(&lookup, state, extra_ic_state, object, name);
   }
 
@@ -777,7 +786,7 @@ void CallICBase::UpdateCaches(LookupResult* lookup,
 MaybeObject* KeyedCallIC::LoadFunction(State state,
                                        Handle<Object> objectGiven,
                                        Handle<Object> keyGiven) {
-  bool terminate;
+  bool terminate = false;
   Handle<Object> object = isolate()->stm()->RedirectLoad(objectGiven, &terminate);
   Handle<Object> key = isolate()->stm()->RedirectLoad(keyGiven, &terminate);
   if (terminate) return isolate()->TerminateExecution();
@@ -793,7 +802,8 @@ MaybeObject* KeyedCallIC::LoadFunction(State state,
     return TypeError("non_object_property_call", object, key);
   }
 
-  if (FLAG_use_ic && state != MEGAMORPHIC && object->IsHeapObject()) {
+  if (UseICWithoutBarriers() && state != MEGAMORPHIC &&
+      object->IsHeapObject()) {
     int argc = target()->arguments_count();
     Heap* heap = Handle<HeapObject>::cast(object)->GetHeap();
     Map* map = heap->non_strict_arguments_elements_map();
@@ -808,7 +818,7 @@ MaybeObject* KeyedCallIC::LoadFunction(State state,
         TraceIC("KeyedCallIC", key, state, target());
 #endif
       }
-    } else if (FLAG_use_ic && state != MEGAMORPHIC &&
+    } else if (UseICWithoutBarriers() && state != MEGAMORPHIC &&
                !object->IsAccessCheckNeeded()) {
       MaybeObject* maybe_code = isolate()->stub_cache()->ComputeCallMegamorphic(
           argc, Code::KEYED_CALL_IC, Code::kNoExtraICState);
@@ -843,7 +853,8 @@ MaybeObject* LoadIC::Load(State state,
                           Handle<Object> objectGiven,
                           Handle<String> name) {
   bool terminate = false;
-  Handle<Object> object = isolate()->stm()->RedirectLoad(objectGiven, &terminate);
+  Handle<Object> object =
+      isolate()->stm()->RedirectLoad(objectGiven, name, &terminate);
   if (terminate) return isolate()->TerminateExecution();
 
   // If the object is undefined or null it's illegal to try to get any
@@ -892,7 +903,7 @@ MaybeObject* LoadIC::Load(State state,
     }
 
     // Use specialized code for getting the length of arrays.
-    if (object->IsJSArray() &&
+    if (object->IsJSArray() && !FLAG_stm &&
         name->Equals(isolate()->heap()->length_symbol())) {
       AssertNoAllocation no_allocation;
       Code* stub = NULL;
@@ -996,6 +1007,16 @@ void LoadIC::UpdateCaches(LookupResult* lookup,
 
   if (HasNormalObjectsInPrototypeChain(isolate(), lookup, *object)) return;
 
+  // Map code caches and the stub cache are shared by all threads (--stm).
+  SharedHeapScope shared_heap_scope(isolate()->heap());
+
+  // Only loads of own fields have STM barriers.
+  if (FLAG_stm && state != UNINITIALIZED &&
+      (!lookup->IsProperty() || lookup->type() != FIELD ||
+       lookup->holder() != *receiver)) {
+    return;
+  }
+
   // Compute the code stub for this load.
   MaybeObject* maybe_code = NULL;
   Object* code;
@@ -1119,8 +1140,9 @@ MaybeObject* KeyedLoadIC::Load(State state,
                                Handle<Object> keyGiven,
                                bool force_generic_stub) {
   bool terminate = false;
-  Handle<Object> object = isolate()->stm()->RedirectLoad(objectGiven, &terminate);
   Handle<Object> key = isolate()->stm()->RedirectLoad(keyGiven, &terminate);
+  Handle<Object> object =
+      isolate()->stm()->RedirectLoad(objectGiven, key, &terminate);
   if (terminate) return isolate()->TerminateExecution();
 
   // Check for values that can be converted into a symbol.
@@ -1142,7 +1164,7 @@ MaybeObject* KeyedLoadIC::Load(State state,
       return TypeError("non_object_property_load", object, name);
     }
 
-    if (FLAG_use_ic) {
+    if (UseICWithoutBarriers()) {
       // TODO(1073): don't ignore the current stub state.
 
       // Use specialized code for getting the length of strings.
@@ -1204,7 +1226,7 @@ MaybeObject* KeyedLoadIC::Load(State state,
     if (name->AsArrayIndex(&index)) {
       HandleScope scope(isolate());
       // Rewrite to the generic keyed load stub.
-      if (FLAG_use_ic) set_target(generic_stub());
+      if (UseICWithoutBarriers()) set_target(generic_stub());
       return Runtime::GetElementOrCharAt(isolate(), object, index);
     }
 
@@ -1217,7 +1239,7 @@ MaybeObject* KeyedLoadIC::Load(State state,
       return ReferenceError("not_defined", name);
     }
 
-    if (FLAG_use_ic) {
+    if (UseICWithoutBarriers()) {
       UpdateCaches(&lookup, state, object, name);
     }
 
@@ -1242,7 +1264,7 @@ MaybeObject* KeyedLoadIC::Load(State state,
 
   // Do not use ICs for objects that require access checks (including
   // the global object).
-  bool use_ic = FLAG_use_ic && !object->IsAccessCheckNeeded();
+  bool use_ic = UseICWithoutBarriers() && !object->IsAccessCheckNeeded();
 
   if (use_ic) {
     Code* stub = generic_stub();
@@ -1393,7 +1415,8 @@ MaybeObject* StoreIC::Store(State state,
                             Handle<String> name,
                             Handle<Object> valueGiven) {
   bool terminate = false;
-  Handle<Object> object = isolate()->stm()->RedirectStore(objectGiven, &terminate);
+  Handle<Object> object =
+      isolate()->stm()->RedirectStore(objectGiven, name, &terminate);
   Handle<Object> value = isolate()->stm()->RedirectStore(valueGiven, &terminate);
   if (terminate) return isolate()->TerminateExecution();
 
@@ -1431,7 +1454,7 @@ MaybeObject* StoreIC::Store(State state,
   }
 
   // Use specialized code for setting the length of arrays.
-  if (receiver->IsJSArray()
+  if (receiver->IsJSArray() && !FLAG_stm
       && name->Equals(isolate()->heap()->length_symbol())
       && JSArray::cast(*receiver)->AllowsSetElementsLength()) {
 #ifdef DEBUG
@@ -1499,6 +1522,12 @@ void StoreIC::UpdateCaches(LookupResult* lookup,
   // current state.
   PropertyType type = lookup->type();
 
+  // Only field stores have STM barriers.
+  if (FLAG_stm && type != FIELD && type != MAP_TRANSITION) return;
+
+  // Map code caches and the stub cache are shared by all threads (--stm).
+  SharedHeapScope shared_heap_scope(isolate()->heap());
+
   // Compute the code stub for this store; used for rewriting to
   // monomorphic state and making sure that the code stub is in the
   // stub cache.
@@ -1758,8 +1787,9 @@ MaybeObject* KeyedStoreIC::Store(State state,
                                  Handle<Object> valueGiven,
                                  bool force_generic) {
   bool terminate = false;
-  Handle<Object> object = isolate()->stm()->RedirectStore(objectGiven, &terminate);
   Handle<Object> key = isolate()->stm()->RedirectStore(keyGiven, &terminate);
+  Handle<Object> object =
+      isolate()->stm()->RedirectStore(objectGiven, key, &terminate);
   Handle<Object> value = isolate()->stm()->RedirectStore(valueGiven, &terminate);
   if (terminate) return isolate()->TerminateExecution();
 
@@ -1790,7 +1820,7 @@ MaybeObject* KeyedStoreIC::Store(State state,
     receiver->LocalLookup(*name, &lookup);
 
     // Update inline cache and stub cache.
-    if (FLAG_use_ic) {
+    if (UseICWithoutBarriers()) {
       UpdateCaches(&lookup, state, strict_mode, receiver, name, value);
     }
 
@@ -1800,7 +1830,7 @@ MaybeObject* KeyedStoreIC::Store(State state,
 
   // Do not use ICs for objects that require access checks (including
   // the global object).
-  bool use_ic = FLAG_use_ic && !object->IsAccessCheckNeeded();
+  bool use_ic = UseICWithoutBarriers() && !object->IsAccessCheckNeeded();
   ASSERT(!(use_ic && object->IsJSGlobalProxy()));
 
   if (use_ic) {
@@ -696,8 +696,14 @@ void IncrementalMarking::Step(intptr_t allocated_bytes) {
   }
 
   if (state_ == SWEEPING) {
-    if (heap_->old_pointer_space()->AdvanceSweeper(bytes_to_process) &&
-        heap_->old_data_space()->AdvanceSweeper(bytes_to_process)) {
+    bool swept;
+    {
+      // The concurrent sweeper may be sweeping too.
+      SharedHeapScope shared_heap(heap_);
+      swept = heap_->old_pointer_space()->AdvanceSweeper(bytes_to_process) &&
+              heap_->old_data_space()->AdvanceSweeper(bytes_to_process);
+    }
+    if (swept) {
       StartMarking();
     }
   } else if (state_ == MARKING) {
@@ -90,7 +90,8 @@ ThreadLocalTop::ThreadLocalTop()
       write_input_buffer_(NULL),
       string_tracker_(NULL),
       regexp_stack_(NULL),
-      transaction_(NULL)
+      transaction_(NULL),
+      idle_transaction_(NULL)
 {
   InitializeInternal();
   // This flag may be set using v8::V8::IgnoreOutOfMemoryException()
@@ -163,6 +164,9 @@ ThreadLocalTop::~ThreadLocalTop() {
 
   delete external_reference_table_;
   external_reference_table_ = NULL;
+
+  STM::DeleteTransaction(idle_transaction_);
+  idle_transaction_ = NULL;
 }
 
 
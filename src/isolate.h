@@ -488,6 +488,7 @@ class ThreadLocalTop {
   friend class Isolate;
 
   Transaction* transaction_;
+  Transaction* idle_transaction_;
 };
 
 
@@ -905,6 +906,8 @@ class Isolate {
 
   Transaction* get_transaction() const { return thread_local_top()->transaction_; }
   void set_transaction(Transaction* transaction) { thread_local_top()->transaction_ = transaction; }
+  Transaction* get_idle_transaction() const { return thread_local_top()->idle_transaction_; }
+  void set_idle_transaction(Transaction* transaction) { thread_local_top()->idle_transaction_ = transaction; }
 
   TranscendentalCache* transcendental_cache() const {
     return thread_local_top()->transcendental_cache_;
@@ -1229,6 +1232,7 @@ class Isolate {
 #undef ISOLATE_FIELD_OFFSET
 #endif
 
+  friend class ConcurrentSweeper;
   friend class ExecutionAccess;
   friend class IsolateInitializer;
   friend class ThreadManager;
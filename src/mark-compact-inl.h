@@ -37,6 +37,25 @@ namespace v8 {
 namespace internal {
 
 
+// Guards state shared by marking threads, does nothing unless several
+// threads mark.
+class ParallelMarkingLock {
+ public:
+  explicit ParallelMarkingLock(MarkCompactCollector* collector)
+      : mutex_(collector->marking_work_pool_ != NULL ?
+               collector->parallel_marking_mutex_ : NULL) {
+    if (mutex_ != NULL) mutex_->Lock();
+  }
+
+  ~ParallelMarkingLock() {
+    if (mutex_ != NULL) mutex_->Unlock();
+  }
+
+ private:
+  Mutex* mutex_;
+};
+
+
 MarkBit Marking::MarkBitFrom(Address addr) {
   MemoryChunk *p = MemoryChunk::FromAddress(addr);
   return p->markbits()->MarkBitFromIndex(p->AddressToMarkbitIndex(addr),
@@ -49,19 +68,33 @@ void MarkCompactCollector::SetFlags(int flags) {
 }
 
 
+MarkingDeque* MarkCompactCollector::marking_deque() {
+  if (marking_work_pool_ == NULL) return &marking_deque_;
+  return thread_marking_deques_[Heap::ThreadIndex()];
+}
+
+
 void MarkCompactCollector::MarkObject(HeapObject* obj, MarkBit mark_bit) {
   ASSERT(Marking::MarkBitFrom(obj) == mark_bit);
-  if (!mark_bit.Get()) {
-    mark_bit.Set();
-    MemoryChunk::IncrementLiveBytes(obj->address(), obj->Size());
-#ifdef DEBUG
-    UpdateLiveObjectCount(obj);
-#endif
+  if (TryMark(obj, mark_bit)) {
     ProcessNewlyMarkedObject(obj);
   }
 }
 
 
+bool MarkCompactCollector::TryMark(HeapObject* obj, MarkBit mark_bit) {
+  ASSERT(Marking::MarkBitFrom(obj) == mark_bit);
+  if (marking_work_pool_ != NULL) {
+    if (!mark_bit.TrySetAtomic()) return false;
+    MemoryChunk::IncrementLiveBytesAtomic(obj->address(), obj->Size());
+    return true;
+  }
+  if (mark_bit.Get()) return false;
+  SetMark(obj, mark_bit);
+  return true;
+}
+
+
 void MarkCompactCollector::SetMark(HeapObject* obj, MarkBit mark_bit) {
   ASSERT(!mark_bit.Get());
   ASSERT(Marking::MarkBitFrom(obj) == mark_bit);
@@ -86,6 +119,9 @@ void MarkCompactCollector::RecordSlot(Object** anchor_slot,
   Page* object_page = Page::FromAddress(reinterpret_cast<Address>(object));
   if (object_page->IsEvacuationCandidate() &&
       !ShouldSkipEvacuationSlotRecording(anchor_slot)) {
+    ParallelMarkingLock lock(this);
+    // Another marking thread may have evicted the page meanwhile.
+    if (!object_page->IsEvacuationCandidate()) return;
     if (!SlotsBuffer::AddTo(&slots_buffer_allocator_,
                             object_page->slots_buffer_address(),
                             slot,
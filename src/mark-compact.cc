@@ -40,6 +40,7 @@
 #include "mark-compact.h"
 #include "objects-visiting.h"
 #include "objects-visiting-inl.h"
+#include "stm.h"
 #include "stub-cache.h"
 
 namespace v8 {
@@ -77,7 +78,14 @@ MarkCompactCollector::MarkCompactCollector() :  // NOLINT
 #endif
       heap_(NULL),
       code_flusher_(NULL),
-      encountered_weak_maps_(NULL) { }
+      encountered_weak_maps_(NULL),
+      mark_in_parallel_(false),
+      marking_work_pool_(NULL),
+      parallel_marking_mutex_(OS::CreateMutex()),
+      sweeper_(NULL),
+      sweeping_mutex_(OS::CreateMutex()) {
+  memset(thread_marking_deques_, 0, sizeof(thread_marking_deques_));
+}
 
 
 #ifdef DEBUG
@@ -701,6 +709,9 @@ MarkCompactCollector::~MarkCompactCollector() {
     delete code_flusher_;
     code_flusher_ = NULL;
   }
+  delete parallel_marking_mutex_;
+  ASSERT(sweeper_ == NULL);
+  delete sweeping_mutex_;
 }
 
 
@@ -916,7 +927,10 @@ class StaticMarkingVisitor : public StaticVisitorBase {
     StackLimitCheck check(heap->isolate());
     if (check.HasOverflowed()) return false;
 
+    // Objects marked in parallel must be claimed atomically before their
+    // bodies are visited, which only MarkObject does.
     MarkCompactCollector* collector = heap->mark_compact_collector();
+    if (collector->marking_work_pool_ != NULL) return false;
     // Visit the unmarked objects.
     for (Object** p = start; p < end; p++) {
       Object* o = *p;
@@ -957,9 +971,12 @@ class StaticMarkingVisitor : public StaticVisitorBase {
     JSWeakMap* weak_map = reinterpret_cast<JSWeakMap*>(object);
 
     // Enqueue weak map in linked list of encountered weak maps.
-    ASSERT(weak_map->next() == Smi::FromInt(0));
-    weak_map->set_next(collector->encountered_weak_maps());
-    collector->set_encountered_weak_maps(weak_map);
+    {
+      ParallelMarkingLock lock(collector);
+      ASSERT(weak_map->next() == Smi::FromInt(0));
+      weak_map->set_next(collector->encountered_weak_maps());
+      collector->set_encountered_weak_maps(weak_map);
+    }
 
     // Skip visiting the backing hash table containing the mappings.
     int object_size = JSWeakMap::BodyDescriptor::SizeOf(map, object);
@@ -980,7 +997,7 @@ class StaticMarkingVisitor : public StaticVisitorBase {
 
     HeapObject* unchecked_table = weak_map->unchecked_table();
     MarkBit mark_bit = Marking::MarkBitFrom(unchecked_table);
-    collector->SetMark(unchecked_table, mark_bit);
+    collector->TryMark(unchecked_table, mark_bit);
   }
 
   static void VisitCode(Map* map, HeapObject* object) {
@@ -1404,7 +1421,8 @@ void MarkCompactCollector::PrepareForCodeFlushing() {
   ASSERT(heap() == Isolate::Current()->heap());
 
   // TODO(1609) Currently incremental marker does not support code flushing.
-  if (!FLAG_flush_code || was_marked_incrementally_) {
+  // Neither does parallel marking, candidates are collected in shared lists.
+  if (!FLAG_flush_code || was_marked_incrementally_ || mark_in_parallel_) {
     EnableCodeFlushing(false);
     return;
   }
@@ -1480,6 +1498,13 @@ class RootMarkingVisitor : public ObjectVisitor {
     collector_->MarkObject(map, map_mark);
     StaticMarkingVisitor::IterateBody(map, object);
 
+    // Parallel marking empties the marking stack after the roots unless it
+    // is filling up.
+    MarkingDeque* deque = &collector_->marking_deque_;
+    if (collector_->mark_in_parallel_ && deque->length() < deque->mask() / 2) {
+      return;
+    }
+
     // Mark all the objects reachable from the map and body.  May leave
     // overflowed objects in the heap.
     collector_->EmptyMarkingDeque();
@@ -1556,10 +1581,10 @@ void MarkCompactCollector::ProcessNewlyMarkedObject(HeapObject* object) {
     if (collect_maps_ && map->instance_type() >= FIRST_JS_RECEIVER_TYPE) {
       MarkMapContents(map);
     } else {
-      marking_deque_.PushBlack(map);
+      PushBlack(map);
     }
   } else {
-    marking_deque_.PushBlack(object);
+    PushBlack(object);
   }
 }
 
@@ -1570,11 +1595,7 @@ void MarkCompactCollector::MarkMapContents(Map* map) {
   // transitions in ClearNonLiveTransitions.
   FixedArray* prototype_transitions = map->prototype_transitions();
   MarkBit mark = Marking::MarkBitFrom(prototype_transitions);
-  if (!mark.Get()) {
-    mark.Set();
-    MemoryChunk::IncrementLiveBytes(prototype_transitions->address(),
-                                    prototype_transitions->Size());
-  }
+  TryMark(prototype_transitions, mark);
 
   Object** raw_descriptor_array_slot =
       HeapObject::RawField(map, Map::kInstanceDescriptorsOrBitField3Offset);
@@ -1599,10 +1620,9 @@ void MarkCompactCollector::MarkMapContents(Map* map) {
 void MarkCompactCollector::MarkDescriptorArray(
     DescriptorArray* descriptors) {
   MarkBit descriptors_mark = Marking::MarkBitFrom(descriptors);
-  if (descriptors_mark.Get()) return;
+  if (!TryMark(descriptors, descriptors_mark)) return;
   // Empty descriptor array is marked as a root before any maps are marked.
   ASSERT(descriptors != heap()->empty_descriptor_array());
-  SetMark(descriptors, descriptors_mark);
 
   FixedArray* contents = reinterpret_cast<FixedArray*>(
       descriptors->get(DescriptorArray::kContentArrayIndex));
@@ -1611,7 +1631,7 @@ void MarkCompactCollector::MarkDescriptorArray(
   ASSERT(contents->IsFixedArray());
   ASSERT(contents->length() >= 2);
   MarkBit contents_mark = Marking::MarkBitFrom(contents);
-  SetMark(contents, contents_mark);
+  TryMark(contents, contents_mark);
   // Contents contains (value, details) pairs.  If the details say that the type
   // of descriptor is MAP_TRANSITION, CONSTANT_TRANSITION,
   // EXTERNAL_ARRAY_TRANSITION or NULL_DESCRIPTOR, we don't mark the value as
@@ -1632,9 +1652,8 @@ void MarkCompactCollector::MarkDescriptorArray(
     if (type < FIRST_PHANTOM_PROPERTY_TYPE) {
       HeapObject* object = HeapObject::cast(value);
       MarkBit mark = Marking::MarkBitFrom(HeapObject::cast(object));
-      if (!mark.Get()) {
-        SetMark(HeapObject::cast(object), mark);
-        marking_deque_.PushBlack(object);
+      if (TryMark(object, mark)) {
+        PushBlack(object);
       }
     } else if (type == ELEMENTS_TRANSITION && value->IsFixedArray()) {
       // For maps with multiple elements transitions, the transition maps are
@@ -1642,14 +1661,12 @@ void MarkCompactCollector::MarkDescriptorArray(
       // that it refers to.
       HeapObject* object = HeapObject::cast(value);
       MarkBit mark = Marking::MarkBitFrom(HeapObject::cast(object));
-      if (!mark.Get()) {
-        SetMark(HeapObject::cast(object), mark);
-      }
+      TryMark(object, mark);
     }
   }
   // The DescriptorArray descriptors contains a pointer to its contents array,
   // but the contents array is already marked.
-  marking_deque_.PushBlack(descriptors);
+  PushBlack(descriptors);
 }
 
 
@@ -1909,6 +1926,155 @@ void MarkCompactCollector::EmptyMarkingDeque() {
 }
 
 
+// Marked objects shared by threads marking in parallel.  A thread with a
+// long marking stack moves objects from its bottom to the pool when another
+// thread is idle, idle threads wait in Take until there is work or all
+// threads are idle (marking is done).
+class MarkingWorkPool {
+ public:
+  static const int kChunkSize = 256;
+
+  explicit MarkingWorkPool(int threads)
+      : mutex_(OS::CreateMutex()), threads_(threads), idle_(0), done_(false) {
+  }
+
+  ~MarkingWorkPool() {
+    ASSERT(objects_.is_empty());
+    delete mutex_;
+  }
+
+  bool IsHungry() { return idle_ > 0; }
+
+  void Share(MarkingDeque* deque, int count) {
+    ScopedLock lock(mutex_);
+    for (int i = 0; i < count && !deque->IsEmpty(); i++) {
+      objects_.Add(deque->Shift());
+    }
+  }
+
+  // Refills the empty marking stack, returns false when marking is done.
+  bool Take(MarkingDeque* deque) {
+    ASSERT(deque->IsEmpty());
+    mutex_->Lock();
+    idle_++;
+    while (objects_.is_empty() && !done_) {
+      if (idle_ == threads_) {
+        done_ = true;
+        break;
+      }
+      mutex_->Unlock();
+      Thread::YieldCPU();
+      mutex_->Lock();
+    }
+    if (done_) {
+      mutex_->Unlock();
+      return false;
+    }
+    idle_--;
+    int count = Min(kChunkSize, deque->mask() / 2);
+    for (int i = 0; i < count && !objects_.is_empty(); i++) {
+      deque->PushBlack(objects_.RemoveLast());
+    }
+    mutex_->Unlock();
+    return true;
+  }
+
+ private:
+  Mutex* mutex_;
+  List<HeapObject*> objects_;
+  int threads_;
+  volatile int idle_;
+  bool done_;
+};
+
+
+// Runs in the GC thread, which marks from the main marking stack, and in
+// threads paused for GC, which allocate their own.
+class ParallelMarkingTask : public GCTask {
+ public:
+  explicit ParallelMarkingTask(MarkCompactCollector* collector)
+      : collector_(collector) { }
+
+  virtual void Run() {
+    int thread = Heap::ThreadIndex();
+    if (collector_->thread_marking_deques_[thread] != NULL) {
+      collector_->EmptyThreadMarkingDeque();
+      return;
+    }
+
+    HeapObject** array = NewArray<HeapObject*>(kHelperDequeLength);
+    MarkingDeque deque;
+    deque.Initialize(reinterpret_cast<Address>(array),
+                     reinterpret_cast<Address>(array + kHelperDequeLength));
+    collector_->thread_marking_deques_[thread] = &deque;
+    collector_->EmptyThreadMarkingDeque();
+    collector_->thread_marking_deques_[thread] = NULL;
+    DeleteArray(array);
+  }
+
+ private:
+  static const int kHelperDequeLength = 16 * KB;
+
+  MarkCompactCollector* collector_;
+};
+
+
+void MarkCompactCollector::PushBlack(HeapObject* object) {
+  MarkingDeque* deque = marking_deque();
+  if (marking_work_pool_ != NULL && deque->IsFull()) {
+    // Other threads get the surplus instead of rescanning the heap.
+    marking_work_pool_->Share(deque, deque->length() / 2);
+  }
+  deque->PushBlack(object);
+}
+
+
+void MarkCompactCollector::EmptyThreadMarkingDeque() {
+  MarkingDeque* deque = marking_deque();
+  MarkingWorkPool* pool = marking_work_pool_;
+  do {
+    while (!deque->IsEmpty()) {
+      if (pool->IsHungry() &&
+          deque->length() >= 2 * MarkingWorkPool::kChunkSize) {
+        pool->Share(deque, MarkingWorkPool::kChunkSize);
+      }
+
+      HeapObject* object = deque->Pop();
+      ASSERT(object->IsHeapObject());
+      ASSERT(heap()->Contains(object));
+      ASSERT(Marking::IsBlack(Marking::MarkBitFrom(object)));
+
+      Map* map = object->map();
+      MarkBit map_mark = Marking::MarkBitFrom(map);
+      MarkObject(map, map_mark);
+
+      StaticMarkingVisitor::IterateBody(map, object);
+    }
+  } while (pool->Take(deque));
+}
+
+
+// Empties the marking stack with help of threads paused for GC.  Weak maps
+// are processed and overflowed objects are rescanned by EmptyMarkingDeque
+// and RefillMarkingDeque afterwards.
+void MarkCompactCollector::EmptyMarkingDequeInParallel() {
+  STM* stm = heap()->isolate()->stm();
+  int helpers = stm->GCHelpers();
+  if (helpers == 0 || marking_deque_.IsEmpty()) return;
+
+  MarkingWorkPool pool(helpers + 1);
+  int thread = Heap::ThreadIndex();
+  thread_marking_deques_[thread] = &marking_deque_;
+  marking_work_pool_ = &pool;
+
+  ParallelMarkingTask task(this);
+  stm->RunGCTask(&task);
+
+  marking_work_pool_ = NULL;
+  thread_marking_deques_[thread] = NULL;
+}
+
+
 // Sweep the heap for overflowed objects, clear their overflow bits, and
 // push them on the marking stack.  Stop early if the marking stack fills
 // before sweeping completes.  If sweeping completes, there are no remaining
@@ -1961,9 +2127,11 @@ void MarkCompactCollector::RefillMarkingDeque() {
 // pointers.  After: the marking stack is empty and there are no overflowed
 // objects in the heap.
 void MarkCompactCollector::ProcessMarkingDeque() {
+  if (mark_in_parallel_) EmptyMarkingDequeInParallel();
   EmptyMarkingDeque();
   while (marking_deque_.overflowed()) {
     RefillMarkingDeque();
+    if (mark_in_parallel_) EmptyMarkingDequeInParallel();
     EmptyMarkingDeque();
   }
 }
@@ -2026,6 +2194,9 @@ void MarkCompactCollector::MarkLiveObjects() {
     marking_deque_.SetOverflowed();
   }
 
+  mark_in_parallel_ = FLAG_parallel_marking &&
+                      heap()->isolate()->stm()->GCHelpers() > 0;
+
   PrepareForCodeFlushing();
 
   RootMarkingVisitor root_visitor(heap());
@@ -2046,15 +2217,13 @@ void MarkCompactCollector::MarkLiveObjects() {
       &IsUnmarkedHeapObject);
   // Then we mark the objects and process the transitive closure.
   heap()->isolate()->global_handles()->IterateWeakRoots(&root_visitor);
-  while (marking_deque_.overflowed()) {
-    RefillMarkingDeque();
-    EmptyMarkingDeque();
-  }
+  ProcessMarkingDeque();
 
   // Repeat host application specific marking to mark unmarked objects
   // reachable from the weak roots.
   ProcessExternalMarking();
 
+  mark_in_parallel_ = false;
   AfterMarking();
 }
 
@@ -2346,6 +2515,92 @@ void MarkCompactCollector::ClearWeakMaps() {
 }
 
 
+// State of a thread evacuating pages in parallel.  Objects move to linear
+// buffers taken from the target space, so the shared heap lock is taken
+// once per buffer instead of once per object.  Code space still allocates
+// object by object, because its skip lists are updated under the lock.
+// New space slots and migration slots are collected here and handed over to
+// the collector when the thread is done.
+class EvacuationContext {
+ public:
+  explicit EvacuationContext(Heap* heap)
+      : heap_(heap), migration_slots_buffer_(NULL) {
+    for (int i = 0; i <= LAST_PAGED_SPACE; i++) {
+      buffers_[i].top = NULL;
+      buffers_[i].limit = NULL;
+    }
+  }
+
+  ~EvacuationContext() {
+    ASSERT(migration_slots_buffer_ == NULL);
+  }
+
+  MaybeObject* AllocateRaw(PagedSpace* space, int size_in_bytes) {
+    if (space->identity() == CODE_SPACE || size_in_bytes > kBufferSize / 4) {
+      return space->AllocateRaw(size_in_bytes);
+    }
+    AllocationInfo* buffer = &buffers_[space->identity()];
+    if (buffer->limit - buffer->top < size_in_bytes) {
+      Object* result;
+      MaybeObject* maybe_result = space->AllocateRaw(kBufferSize);
+      if (!maybe_result->ToObject(&result)) {
+        return space->AllocateRaw(size_in_bytes);
+      }
+      ReleaseBuffer(space);
+      buffer->top = HeapObject::cast(result)->address();
+      buffer->limit = buffer->top + kBufferSize;
+    }
+    HeapObject* object = HeapObject::FromAddress(buffer->top);
+    buffer->top += size_in_bytes;
+    return object;
+  }
+
+  void RecordNewSpaceSlot(Address slot) {
+    new_space_slots_.Add(slot);
+  }
+
+  SlotsBuffer** migration_slots_buffer_address() {
+    return &migration_slots_buffer_;
+  }
+
+  // Returns unused parts of the buffers to the free lists.
+  void ReleaseBuffers() {
+    ReleaseBuffer(heap_->old_pointer_space());
+    ReleaseBuffer(heap_->old_data_space());
+  }
+
+  // Called by one thread at a time.
+  void HandOver(List<SlotsBuffer*>* migration_slots_buffers) {
+    for (int i = 0; i < new_space_slots_.length(); i++) {
+      heap_->store_buffer()->Mark(new_space_slots_[i]);
+    }
+    new_space_slots_.Clear();
+    if (migration_slots_buffer_ != NULL) {
+      migration_slots_buffers->Add(migration_slots_buffer_);
+      migration_slots_buffer_ = NULL;
+    }
+  }
+
+ private:
+  static const int kBufferSize = 8 * KB;
+
+  void ReleaseBuffer(PagedSpace* space) {
+    AllocationInfo* buffer = &buffers_[space->identity()];
+    if (buffer->top < buffer->limit) {
+      SharedHeapScope shared_heap(heap_);
+      space->Free(buffer->top, static_cast<int>(buffer->limit - buffer->top));
+    }
+    buffer->top = NULL;
+    buffer->limit = NULL;
+  }
+
+  Heap* heap_;
+  AllocationInfo buffers_[LAST_PAGED_SPACE + 1];
+  List<Address> new_space_slots_;
+  SlotsBuffer* migration_slots_buffer_;
+};
+
+
 // We scavange new space simultaneously with sweeping. This is done in two
 // passes.
 //
@@ -2363,8 +2618,11 @@ void MarkCompactCollector::ClearWeakMaps() {
 void MarkCompactCollector::MigrateObject(Address dst,
                                          Address src,
                                          int size,
-                                         AllocationSpace dest) {
+                                         AllocationSpace dest,
+                                         EvacuationContext* context) {
   HEAP_PROFILE(heap(), ObjectMoveEvent(src, dst));
+  SlotsBuffer** migration_slots_buffer = (context != NULL) ?
+      context->migration_slots_buffer_address() : &migration_slots_buffer_;
   if (dest == OLD_POINTER_SPACE || dest == LO_SPACE) {
     Address src_slot = src;
     Address dst_slot = dst;
@@ -2376,10 +2634,14 @@ void MarkCompactCollector::MigrateObject(Address dst,
       Memory::Object_at(dst_slot) = value;
 
       if (heap_->InNewSpace(value)) {
-        heap_->store_buffer()->Mark(dst_slot);
+        if (context != NULL) {
+          context->RecordNewSpaceSlot(dst_slot);
+        } else {
+          heap_->store_buffer()->Mark(dst_slot);
+        }
       } else if (value->IsHeapObject() && IsOnEvacuationCandidate(value)) {
         SlotsBuffer::AddTo(&slots_buffer_allocator_,
-                           &migration_slots_buffer_,
+                           migration_slots_buffer,
                            reinterpret_cast<Object**>(dst_slot),
                            SlotsBuffer::IGNORE_OVERFLOW);
       }
@@ -2395,7 +2657,7 @@ void MarkCompactCollector::MigrateObject(Address dst,
 
       if (Page::FromAddress(code_entry)->IsEvacuationCandidate()) {
         SlotsBuffer::AddTo(&slots_buffer_allocator_,
-                            &migration_slots_buffer_,
+                            migration_slots_buffer,
                             SlotsBuffer::CODE_ENTRY_SLOT,
                             code_entry_slot,
                             SlotsBuffer::IGNORE_OVERFLOW);
@@ -2406,7 +2668,7 @@ void MarkCompactCollector::MigrateObject(Address dst,
     PROFILE(heap()->isolate(), CodeMoveEvent(src, dst));
     heap()->MoveBlock(dst, src, size);
     SlotsBuffer::AddTo(&slots_buffer_allocator_,
-                       &migration_slots_buffer_,
+                       migration_slots_buffer,
                        SlotsBuffer::RELOCATED_CODE_OBJECT,
                        dst,
                        SlotsBuffer::IGNORE_OVERFLOW);
@@ -2622,8 +2884,8 @@ void MarkCompactCollector::EvacuateNewSpace() {
 }
 
 
-void MarkCompactCollector::EvacuateLiveObjectsFromPage(Page* p) {
-  AlwaysAllocateScope always_allocate;
+void MarkCompactCollector::EvacuateLiveObjectsFromPage(
+    Page* p, EvacuationContext* context) {
   PagedSpace* space = static_cast<PagedSpace*>(p->owner());
   ASSERT(p->IsEvacuationCandidate() && !p->WasSwept());
   MarkBit::CellType* cells = p->markbits()->cells();
@@ -2655,7 +2917,8 @@ void MarkCompactCollector::EvacuateLiveObjectsFromPage(Page* p) {
 
       int size = object->Size();
 
-      MaybeObject* target = space->AllocateRaw(size);
+      MaybeObject* target = (context != NULL) ?
+          context->AllocateRaw(space, size) : space->AllocateRaw(size);
       if (target->IsFailure()) {
         // OS refused to give us memory.
         V8::FatalProcessOutOfMemory("Evacuation");
@@ -2667,7 +2930,8 @@ void MarkCompactCollector::EvacuateLiveObjectsFromPage(Page* p) {
       MigrateObject(HeapObject::cast(target_object)->address(),
                     object_addr,
                     size,
-                    space->identity());
+                    space->identity(),
+                    context);
       ASSERT(object->map_word().IsForwardingAddress());
     }
 
@@ -2679,6 +2943,13 @@ void MarkCompactCollector::EvacuateLiveObjectsFromPage(Page* p) {
 
 
 void MarkCompactCollector::EvacuatePages() {
+  // Covers threads evacuating in parallel as well.
+  AlwaysAllocateScope always_allocate;
+  if (CanCompactInParallel()) {
+    EvacuatePagesInParallel();
+    return;
+  }
+
   int npages = evacuation_candidates_.length();
   for (int i = 0; i < npages; i++) {
     Page* p = evacuation_candidates_[i];
@@ -2688,16 +2959,9 @@ void MarkCompactCollector::EvacuatePages() {
       // During compaction we might have to request a new page.
       // Check that space still have room for that.
       if (static_cast<PagedSpace*>(p->owner())->CanExpand()) {
-        EvacuateLiveObjectsFromPage(p);
+        EvacuateLiveObjectsFromPage(p, NULL);
       } else {
-        // Without room for expansion evacuation is not guaranteed to succeed.
-        // Pessimistically abandon unevacuated pages.
-        for (int j = i; j < npages; j++) {
-          Page* page = evacuation_candidates_[j];
-          slots_buffer_allocator_.DeallocateChain(page->slots_buffer_address());
-          page->ClearEvacuationCandidate();
-          page->SetFlag(Page::RESCAN_ON_EVACUATION);
-        }
+        AbandonEvacuationCandidates(i);
         return;
       }
     }
@@ -2705,6 +2969,152 @@ void MarkCompactCollector::EvacuatePages() {
 }
 
 
+void MarkCompactCollector::AbandonEvacuationCandidates(int from) {
+  // Without room for expansion evacuation is not guaranteed to succeed.
+  // Pessimistically abandon unevacuated pages.
+  int npages = evacuation_candidates_.length();
+  for (int j = from; j < npages; j++) {
+    Page* page = evacuation_candidates_[j];
+    slots_buffer_allocator_.DeallocateChain(page->slots_buffer_address());
+    page->ClearEvacuationCandidate();
+    page->SetFlag(Page::RESCAN_ON_EVACUATION);
+  }
+}
+
+
+bool MarkCompactCollector::CanCompactInParallel() {
+  // Profiler and logger events of moved objects are not thread-safe.
+  Isolate* isolate = heap()->isolate();
+  if (isolate->logger()->is_logging() || CpuProfiler::is_profiling(isolate)) {
+    return false;
+  }
+  HeapProfiler* profiler = isolate->heap_profiler();
+  if (profiler != NULL && profiler->is_profiling()) return false;
+
+  return FLAG_parallel_compaction && isolate->stm()->GCHelpers() > 0;
+}
+
+
+// Hands out evacuation candidates to the GC thread and threads paused for
+// GC, one page at a time.  Like the serial path, a page is only evacuated if
+// its space could still expand by a page, but every page in flight reserves
+// its own page of that capacity.
+class ParallelEvacuationTask : public GCTask {
+ public:
+  explicit ParallelEvacuationTask(MarkCompactCollector* collector)
+      : collector_(collector),
+        mutex_(OS::CreateMutex()),
+        next_page_(0),
+        abandoned_(false) {
+    for (int i = 0; i <= LAST_PAGED_SPACE; i++) {
+      in_flight_[i] = 0;
+    }
+  }
+
+  virtual ~ParallelEvacuationTask() {
+    delete mutex_;
+  }
+
+  virtual void Run() {
+    EvacuationContext context(collector_->heap());
+    Page* p = NULL;
+    while ((p = NextPage(p)) != NULL) {
+      collector_->EvacuateLiveObjectsFromPage(p, &context);
+    }
+    context.ReleaseBuffers();
+
+    ScopedLock lock(mutex_);
+    context.HandOver(&collector_->parallel_migration_slots_buffers_);
+  }
+
+ private:
+  // Releases the reservation of the evacuated page and claims the next one.
+  Page* NextPage(Page* evacuated) {
+    ScopedLock lock(mutex_);
+    if (evacuated != NULL) {
+      in_flight_[evacuated->owner()->identity()]--;
+    }
+    List<Page*>* pages = &collector_->evacuation_candidates_;
+    while (!abandoned_ && next_page_ < pages->length()) {
+      Page* p = pages->at(next_page_++);
+      ASSERT(p->IsEvacuationCandidate() ||
+             p->IsFlagSet(Page::RESCAN_ON_EVACUATION));
+      if (!p->IsEvacuationCandidate()) continue;
+
+      // Other threads may be expanding the space.
+      SharedHeapScope shared_heap(collector_->heap());
+      PagedSpace* space = static_cast<PagedSpace*>(p->owner());
+      if (space->CanExpand(in_flight_[space->identity()] + 1)) {
+        in_flight_[space->identity()]++;
+        return p;
+      }
+      // Pages claimed by other threads are evacuated, the rest is not.
+      collector_->AbandonEvacuationCandidates(next_page_ - 1);
+      abandoned_ = true;
+    }
+    return NULL;
+  }
+
+  MarkCompactCollector* collector_;
+  Mutex* mutex_;
+  int next_page_;
+  bool abandoned_;
+  // Pages being evacuated into each space.
+  int in_flight_[LAST_PAGED_SPACE + 1];
+};
+
+
+void MarkCompactCollector::EvacuatePagesInParallel() {
+  ParallelEvacuationTask task(this);
+  heap()->isolate()->stm()->RunGCTask(&task);
+}
+
+
+// Each buffer chain is updated by one thread, slots on different chains may
+// be updated twice but always to the same forwarding address.
+class SlotsUpdatingTask : public GCTask {
+ public:
+  SlotsUpdatingTask(Heap* heap,
+                    List<SlotsBuffer*>* buffers,
+                    bool code_slots_filtering_required)
+      : heap_(heap),
+        buffers_(buffers),
+        code_slots_filtering_required_(code_slots_filtering_required),
+        next_buffer_(0) { }
+
+  virtual void Run() {
+    while (true) {
+      int i = NoBarrier_AtomicIncrement(&next_buffer_, 1) - 1;
+      if (i >= buffers_->length()) return;
+      SlotsBuffer::UpdateSlotsRecordedIn(heap_,
+                                         buffers_->at(i),
+                                         code_slots_filtering_required_);
+    }
+  }
+
+ private:
+  Heap* heap_;
+  List<SlotsBuffer*>* buffers_;
+  bool code_slots_filtering_required_;
+  volatile Atomic32 next_buffer_;
+};
+
+
+void MarkCompactCollector::UpdateSlotsRecordedIn(
+    List<SlotsBuffer*>* buffers, bool code_slots_filtering_required) {
+  if (buffers->length() > 1 && CanCompactInParallel()) {
+    SlotsUpdatingTask task(heap(), buffers, code_slots_filtering_required);
+    heap()->isolate()->stm()->RunGCTask(&task);
+    return;
+  }
+  for (int i = 0; i < buffers->length(); i++) {
+    SlotsBuffer::UpdateSlotsRecordedIn(heap_,
+                                       buffers->at(i),
+                                       code_slots_filtering_required);
+  }
+}
+
+
 class EvacuationWeakObjectRetainer : public WeakObjectRetainer {
  public:
   virtual Object* RetainAs(Object* object) {
@@ -2994,9 +3404,17 @@ void MarkCompactCollector::EvacuateNewSpaceAndCandidates() {
     heap_->store_buffer()->IteratePointersToNewSpace(&UpdatePointer);
   }
 
-  SlotsBuffer::UpdateSlotsRecordedIn(heap_,
-                                     migration_slots_buffer_,
-                                     code_slots_filtering_required);
+  // Slots recorded while migrating objects and while marking are updated
+  // at once, by threads paused for GC when compacting in parallel.
+  List<SlotsBuffer*> slots_buffers;
+  slots_buffers.Add(migration_slots_buffer_);
+  slots_buffers.AddAll(parallel_migration_slots_buffers_);
+  int npages = evacuation_candidates_.length();
+  for (int i = 0; i < npages; i++) {
+    Page* p = evacuation_candidates_[i];
+    if (p->IsEvacuationCandidate()) slots_buffers.Add(p->slots_buffer());
+  }
+  UpdateSlotsRecordedIn(&slots_buffers, code_slots_filtering_required);
   if (FLAG_trace_fragmentation) {
     PrintF("  migration slots buffer: %d\n",
            SlotsBuffer::SizeOfChain(migration_slots_buffer_));
@@ -3018,16 +3436,12 @@ void MarkCompactCollector::EvacuateNewSpaceAndCandidates() {
     }
   }
 
-  int npages = evacuation_candidates_.length();
   for (int i = 0; i < npages; i++) {
     Page* p = evacuation_candidates_[i];
     ASSERT(p->IsEvacuationCandidate() ||
            p->IsFlagSet(Page::RESCAN_ON_EVACUATION));
 
     if (p->IsEvacuationCandidate()) {
-      SlotsBuffer::UpdateSlotsRecordedIn(heap_,
-                                         p->slots_buffer(),
-                                         code_slots_filtering_required);
       if (FLAG_trace_fragmentation) {
         PrintF("  page %p slots buffer: %d\n",
                reinterpret_cast<void*>(p),
@@ -3107,6 +3521,11 @@ void MarkCompactCollector::EvacuateNewSpaceAndCandidates() {
 
   slots_buffer_allocator_.DeallocateChain(&migration_slots_buffer_);
   ASSERT(migration_slots_buffer_ == NULL);
+  for (int i = 0; i < parallel_migration_slots_buffers_.length(); i++) {
+    slots_buffer_allocator_.DeallocateChain(
+        &parallel_migration_slots_buffers_[i]);
+  }
+  parallel_migration_slots_buffers_.Rewind(0);
   for (int i = 0; i < npages; i++) {
     Page* p = evacuation_candidates_[i];
     if (!p->IsEvacuationCandidate()) continue;
@@ -3503,6 +3922,10 @@ void MarkCompactCollector::SweepSpace(PagedSpace* space,
 
   intptr_t freed_bytes = 0;
   intptr_t newspace_size = space->heap()->new_space()->Size();
+  // The background sweeper takes over after the first page.
+  if (sweeper == LAZY_CONSERVATIVE && FLAG_stm && FLAG_concurrent_sweeping) {
+    newspace_size = 0;
+  }
   bool lazy_sweeping_active = false;
   bool unused_page_present = false;
 
@@ -3616,6 +4039,83 @@ void MarkCompactCollector::SweepSpaces() {
 
   // Deallocate unmarked objects and clear marked bits for marked objects.
   heap_->lo_space()->FreeUnmarkedObjects();
+
+  if (how_to_sweep == LAZY_CONSERVATIVE && FLAG_stm &&
+      FLAG_concurrent_sweeping) {
+    StartConcurrentSweeping();
+  }
+}
+
+
+// Sweeps pages left for lazy sweeping while worker threads run.  Pages are
+// swept one at a time under the shared heap lock, which allocation takes
+// before it refills from a paged space, so allocation either finds a page
+// swept or sweeps it itself.  GC holds the sweeping mutex while it runs and
+// abandons unswept pages, the sweeper continues with whatever is left after
+// it.  The shared heap lock stays free for threads helping with the GC.
+class ConcurrentSweeper : public Thread {
+ public:
+  explicit ConcurrentSweeper(Heap* heap)
+      : Thread("v8:Sweeper"),
+        heap_(heap),
+        resume_(OS::CreateSemaphore(0)),
+        stop_(false) { }
+
+  virtual ~ConcurrentSweeper() {
+    delete resume_;
+  }
+
+  virtual void Run() {
+    // Free list code reads the heap of the current isolate.
+    Isolate::SetIsolateThreadLocals(heap_->isolate());
+    while (true) {
+      resume_->Wait();
+      if (stop_) return;
+      SweepLazily(heap_->old_pointer_space());
+      SweepLazily(heap_->old_data_space());
+    }
+  }
+
+  void Resume() {
+    resume_->Signal();
+  }
+
+  void Stop() {
+    stop_ = true;
+    resume_->Signal();
+    Join();
+  }
+
+ private:
+  void SweepLazily(PagedSpace* space) {
+    bool done = false;
+    while (!done && !stop_) {
+      ScopedLock sweeping(heap_->mark_compact_collector()->sweeping_mutex());
+      SharedHeapScope shared_heap(heap_);
+      done = space->AdvanceSweeper(1);
+    }
+  }
+
+  Heap* heap_;
+  Semaphore* resume_;
+  volatile bool stop_;
+};
+
+
+void MarkCompactCollector::StartConcurrentSweeping() {
+  if (sweeper_ == NULL) {
+    sweeper_ = new ConcurrentSweeper(heap());
+    sweeper_->Start();
+  }
+  sweeper_->Resume();
+}
+
+
+void MarkCompactCollector::StopConcurrentSweeping() {
+  if (sweeper_ == NULL) return;
+  sweeper_->Stop();
+  delete sweeper_;
+  sweeper_ = NULL;
 }
 
 
@@ -3697,6 +4197,9 @@ void MarkCompactCollector::RecordRelocSlot(RelocInfo* rinfo, Code* target) {
   if (target_page->IsEvacuationCandidate() &&
       (rinfo->host() == NULL ||
        !ShouldSkipEvacuationSlotRecording(rinfo->host()))) {
+    ParallelMarkingLock lock(this);
+    // Another marking thread may have evicted the page meanwhile.
+    if (!target_page->IsEvacuationCandidate()) return;
     if (!SlotsBuffer::AddTo(&slots_buffer_allocator_,
                             target_page->slots_buffer_address(),
                             SlotTypeForRMode(rinfo->rmode()),
@@ -3713,6 +4216,9 @@ void MarkCompactCollector::RecordCodeEntrySlot(Address slot, Code* target) {
       reinterpret_cast<Address>(target));
   if (target_page->IsEvacuationCandidate() &&
       !ShouldSkipEvacuationSlotRecording(reinterpret_cast<Object**>(slot))) {
+    ParallelMarkingLock lock(this);
+    // Another marking thread may have evicted the page meanwhile.
+    if (!target_page->IsEvacuationCandidate()) return;
     if (!SlotsBuffer::AddTo(&slots_buffer_allocator_,
                             target_page->slots_buffer_address(),
                             SlotsBuffer::CODE_ENTRY_SLOT,
@@ -41,7 +41,10 @@ typedef bool (*IsAliveFunction)(HeapObject* obj, int* size, int* offset);
 
 // Forward declarations.
 class CodeFlusher;
+class ConcurrentSweeper;
+class EvacuationContext;
 class GCTracer;
+class MarkingWorkPool;
 class MarkingVisitor;
 class RootMarkingVisitor;
 
@@ -242,6 +245,18 @@ class MarkingDeque {
     return object;
   }
 
+  // Removes the bottom (oldest) element, used to share work with other
+  // marking threads.
+  inline HeapObject* Shift() {
+    ASSERT(!IsEmpty());
+    HeapObject* object = array_[bottom_];
+    bottom_ = ((bottom_ + 1) & mask_);
+    ASSERT(object->IsHeapObject());
+    return object;
+  }
+
+  inline int length() { return (top_ - bottom_) & mask_; }
+
   inline void UnshiftGrey(HeapObject* object) {
     ASSERT(object->IsHeapObject());
     if (IsFull()) {
@@ -485,6 +500,13 @@ class MarkCompactCollector {
   inline bool is_code_flushing_enabled() const { return code_flusher_ != NULL; }
   void EnableCodeFlushing(bool enable);
 
+  // Pages left for lazy sweeping are swept by a background thread when
+  // --concurrent-sweeping is on.  The thread is stopped before the heap is
+  // torn down.  It sweeps a page at a time holding the sweeping mutex,
+  // which the collector holds for the whole GC.
+  void StopConcurrentSweeping();
+  Mutex* sweeping_mutex() { return sweeping_mutex_; }
+
   enum SweeperType {
     CONSERVATIVE,
     LAZY_CONSERVATIVE,
@@ -542,10 +564,12 @@ class MarkCompactCollector {
 
   INLINE(void RecordSlot(Object** anchor_slot, Object** slot, Object* object));
 
+  // The context is passed by threads evacuating pages in parallel.
   void MigrateObject(Address dst,
                      Address src,
                      int size,
-                     AllocationSpace to_old_space);
+                     AllocationSpace to_old_space,
+                     EvacuationContext* context = NULL);
 
   bool TryPromoteObject(HeapObject* object, int object_size);
 
@@ -618,6 +642,9 @@ class MarkCompactCollector {
   friend class StaticMarkingVisitor;
   friend class CodeMarkingVisitor;
   friend class SharedFunctionInfoMarkingVisitor;
+  friend class ParallelMarkingTask;
+  friend class ParallelMarkingLock;
+  friend class ParallelEvacuationTask;
 
   void PrepareForCodeFlushing();
 
@@ -630,8 +657,18 @@ class MarkCompactCollector {
 
   INLINE(void SetMark(HeapObject* obj, MarkBit mark_bit));
 
+  // Marks the object unless it is marked already (possibly by another
+  // marking thread).  Returns true if the object was newly marked.
+  INLINE(bool TryMark(HeapObject* obj, MarkBit mark_bit));
+
   void ProcessNewlyMarkedObject(HeapObject* obj);
 
+  // Marking deque of the current thread.
+  inline MarkingDeque* marking_deque();
+
+  // Pushes a marked object on the marking deque of the current thread.
+  void PushBlack(HeapObject* object);
+
   // Creates back pointers for all map transitions, stores them in
   // the prototype field.  The original prototype pointers are restored
   // in ClearNonLiveTransitions().  All JSObject maps
@@ -677,6 +714,14 @@ class MarkCompactCollector {
   // flag on the marking stack.
   void RefillMarkingDeque();
 
+  // Threads paused for GC mark objects reachable from the marking stack
+  // together with this thread (--parallel-marking).  Each thread has its
+  // own marking stack and shares surplus work through a pool, deques never
+  // overflow while marking in parallel.  Code flushing is disabled when
+  // marking in parallel.
+  void EmptyMarkingDequeInParallel();
+  void EmptyThreadMarkingDeque();
+
   // After reachable maps have been marked process per context object
   // literal map caches removing unmarked entries.
   void ProcessMapCaches();
@@ -727,14 +772,27 @@ class MarkCompactCollector {
 
   void EvacuateNewSpace();
 
-  void EvacuateLiveObjectsFromPage(Page* p);
+  void EvacuateLiveObjectsFromPage(Page* p, EvacuationContext* context);
 
   void EvacuatePages();
 
+  // Threads paused for GC evacuate candidate pages together with this
+  // thread and update slots recorded in their slots buffers
+  // (--parallel-compaction).  Each thread claims whole pages and allocates
+  // from its own linear buffers in the target spaces.
+  bool CanCompactInParallel();
+  void EvacuatePagesInParallel();
+  void UpdateSlotsRecordedIn(List<SlotsBuffer*>* buffers,
+                             bool code_slots_filtering_required);
+
+  void AbandonEvacuationCandidates(int from);
+
   void EvacuateNewSpaceAndCandidates();
 
   void SweepSpace(PagedSpace* space, SweeperType sweeper);
 
+  void StartConcurrentSweeping();
+
 
 #ifdef DEBUG
   // -----------------------------------------------------------------------
@@ -778,6 +836,21 @@ class MarkCompactCollector {
   CodeFlusher* code_flusher_;
   Object* encountered_weak_maps_;
 
+  // Decided for each full GC, see EmptyMarkingDequeInParallel.
+  bool mark_in_parallel_;
+
+  // Set while several threads mark, shared state not owned by a thread
+  // (slots buffers, weak maps list) is then guarded by the mutex.
+  MarkingWorkPool* marking_work_pool_;
+  Mutex* parallel_marking_mutex_;
+  MarkingDeque* thread_marking_deques_[MAX_THREADS];
+
+  ConcurrentSweeper* sweeper_;
+  Mutex* sweeping_mutex_;
+
+  // Migration slots of threads that evacuated pages in parallel.
+  List<SlotsBuffer*> parallel_migration_slots_buffers_;
+
   List<Page*> evacuation_candidates_;
   List<Code*> invalidated_code_;
 
@@ -2165,6 +2165,8 @@ static MaybeObject* AddElementsTransitionMapToDescriptor(
 
 MaybeObject* JSObject::GetElementsTransitionMap(ElementsKind elements_kind) {
   Heap* current_heap = GetHeap();
+  // Transitions are added to maps shared by all threads (--stm).
+  SharedHeapScope shared_heap_scope(current_heap);
   Map* current_map = map();
   DescriptorArray* descriptors = current_map->instance_descriptors();
   String* elements_transition_sentinel_name = current_heap->empty_symbol();
@@ -313,6 +313,14 @@ void ExternalReferenceTable::PopulateTable(Isolate* isolate) {
       RUNTIME_ENTRY,
       7,
       "IncrementalMarking::RecordWrite");
+  Add(ExternalReference::stm_load_barrier_function(isolate).address(),
+      RUNTIME_ENTRY,
+      8,
+      "STM::LoadBarrier");
+  Add(ExternalReference::stm_store_barrier_function(isolate).address(),
+      RUNTIME_ENTRY,
+      9,
+      "STM::StoreBarrier");
 
 
 
@@ -267,6 +267,7 @@ HeapObject* PagedSpace::AllocateLinearly(int size_in_bytes) {
 MaybeObject* PagedSpace::AllocateRaw(int size_in_bytes) {
   ASSERT(HasBeenSetup());
   ASSERT_OBJECT_SIZE(size_in_bytes);
+  SharedHeapScope shared_heap_scope(heap());
   HeapObject* object = AllocateLinearly(size_in_bytes);
   if (object != NULL) {
     if (identity() == CODE_SPACE) {
@@ -297,6 +298,12 @@ MaybeObject* PagedSpace::AllocateRaw(int size_in_bytes) {
 
 // -----------------------------------------------------------------------------
 // NewSpace
+MaybeObject* NewSpace::AllocateRaw(int size_in_bytes) {
+  SharedHeapScope shared_heap_scope(heap());
+  return AllocateRawInternal(size_in_bytes);
+}
+
+
 MaybeObject* NewSpace::AllocateRawInternal(int size_in_bytes) {
   Address old_top = allocation_info_.top;
   if (allocation_info_.limit - old_top < size_in_bytes) {
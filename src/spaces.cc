@@ -721,16 +721,17 @@ MaybeObject* PagedSpace::FindObject(Address addr) {
   return Failure::Exception();
 }
 
-bool PagedSpace::CanExpand() {
+bool PagedSpace::CanExpand(int pages) {
   ASSERT(max_capacity_ % Page::kObjectAreaSize == 0);
   ASSERT(Capacity() % Page::kObjectAreaSize == 0);
+  ASSERT(pages > 0);
 
   if (Capacity() == max_capacity_) return false;
 
   ASSERT(Capacity() < max_capacity_);
 
   // Are we going to exceed capacity for this space?
-  if ((Capacity() + Page::kPageSize) > max_capacity_) return false;
+  if ((Capacity() + pages * Page::kPageSize) > max_capacity_) return false;
 
   return true;
 }
@@ -2307,6 +2308,7 @@ void LargeObjectSpace::TearDown() {
 
 MaybeObject* LargeObjectSpace::AllocateRaw(int object_size,
                                            Executability executable) {
+  SharedHeapScope shared_heap_scope(heap());
   // Check if we want to force a GC before growing the old space further.
   // If so, fail the allocation.
   if (!heap()->always_allocate() &&
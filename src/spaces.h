@@ -140,6 +140,20 @@ class MarkBit {
   inline bool Get() { return (*cell_ & mask_) != 0; }
   inline void Clear() { *cell_ &= ~mask_; }
 
+  // Sets the bit without losing bits set by other threads in the same cell.
+  // Returns false if the bit was already set.
+  inline bool TrySetAtomic() {
+    volatile Atomic32* cell = reinterpret_cast<volatile Atomic32*>(cell_);
+    while (true) {
+      Atomic32 old_value = NoBarrier_Load(cell);
+      if ((old_value & mask_) != 0) return false;
+      Atomic32 new_value = old_value | mask_;
+      if (Acquire_CompareAndSwap(cell, old_value, new_value) == old_value) {
+        return true;
+      }
+    }
+  }
+
   inline bool data_only() { return data_only_; }
 
   inline MarkBit Next() {
@@ -477,6 +491,13 @@ class MemoryChunk {
     MemoryChunk::FromAddress(address)->IncrementLiveBytes(by);
   }
 
+  // Used when several threads mark objects on the same page.
+  static void IncrementLiveBytesAtomic(Address address, int by) {
+    MemoryChunk* chunk = MemoryChunk::FromAddress(address);
+    NoBarrier_AtomicIncrement(
+        reinterpret_cast<volatile Atomic32*>(&chunk->live_byte_count_), by);
+  }
+
   static const intptr_t kAlignment =
       (static_cast<uintptr_t>(1) << kPageSizeBits);
 
@@ -1598,7 +1619,8 @@ class PagedSpace : public Space {
 
   void EvictEvacuationCandidatesFromFreeLists();
 
-  bool CanExpand();
+  // Whether the space can grow by the given number of pages.
+  bool CanExpand(int pages = 1);
 
  protected:
   // Maximum capacity of this space.
@@ -2151,9 +2173,7 @@ class NewSpace : public Space {
   Address* allocation_top_address() { return &allocation_info_.top; }
   Address* allocation_limit_address() { return &allocation_info_.limit; }
 
-  MUST_USE_RESULT MaybeObject* AllocateRaw(int size_in_bytes) {
-    return AllocateRawInternal(size_in_bytes);
-  }
+  MUST_USE_RESULT inline MaybeObject* AllocateRaw(int size_in_bytes);
 
   // Reset the allocation pointer to the beginning of the active semispace.
   void ResetAllocationInfo();
@@ -0,0 +1,197 @@
+#include "v8.h"
+#include "stm-contention.h"
+
+namespace v8 {
+namespace internal {
+
+ContentionManager::ContentionManager(const char* name) :
+  name_(name),
+  statistics_mutex_(OS::CreateMutex()),
+  commits_(0),
+  aborts_(0),
+  total_latency_(0),
+  max_latency_(0),
+  total_wait_(0),
+  total_wasted_(0),
+  total_zombie_(0) {
+}
+
+ContentionManager::~ContentionManager() {
+  delete statistics_mutex_;
+}
+
+void ContentionManager::RecordCommit(int64_t latency) {
+  ScopedLock lock(statistics_mutex_);
+  commits_++;
+  total_latency_ += latency;
+  if (latency > max_latency_) {
+    max_latency_ = latency;
+  }
+}
+
+void ContentionManager::RecordAbort(int64_t wasted, int64_t zombie) {
+  ScopedLock lock(statistics_mutex_);
+  aborts_++;
+  total_wasted_ += wasted;
+  total_zombie_ += zombie;
+}
+
+void ContentionManager::RecordWait(int64_t wait) {
+  ScopedLock lock(statistics_mutex_);
+  total_wait_ += wait;
+}
+
+void ContentionManager::PrintStatistics() {
+  ScopedLock lock(statistics_mutex_);
+  int average = commits_ > 0 ?
+      static_cast<int>(total_latency_ / commits_) : 0;
+  printf("%s contention policy, %d commits, %d aborts, "
+         "latency %d us average %d us max, %d us waiting\n",
+         name_, commits_, aborts_, average,
+         static_cast<int>(max_latency_), static_cast<int>(total_wait_));
+  printf("%d us wasted in aborted attempts, %d us of it after abort\n",
+         static_cast<int>(total_wasted_), static_cast<int>(total_zombie_));
+}
+
+// previous behaviour, aborted event is restarted immediately
+class ImmediateRetry : public ContentionManager {
+ public:
+  ImmediateRetry() : ContentionManager("none") {}
+};
+
+// aborted event waits for random time from range that doubles with each
+// abort, so that events aborting each other get out of step
+class ExponentialBackoff : public ContentionManager {
+ public:
+  ExponentialBackoff() : ContentionManager("backoff") {}
+
+  virtual void BeforeAttempt(int attempt) {
+    if (attempt == 0) {
+      return;
+    }
+
+    int limit = FLAG_stm_backoff_max;
+    if (attempt < kMaxShift && (kMinBackoff << attempt) < limit) {
+      limit = kMinBackoff << attempt;
+    }
+    if (limit <= 0) {
+      return;
+    }
+
+    // ticks differ among threads enough to spread them
+    uint32_t random = ComputeIntegerHash(
+        static_cast<uint32_t>(OS::Ticks()) ^ static_cast<uint32_t>(attempt));
+    Wait(random % limit);
+  }
+
+ private:
+  static const int kMinBackoff = 8;  // microseconds
+  static const int kMaxShift = 20;
+
+  static void Wait(int microseconds) {
+    if (microseconds >= 2000) {
+      OS::Sleep(microseconds / 1000);
+      return;
+    }
+
+    int64_t deadline = OS::Ticks() + microseconds;
+    while (OS::Ticks() < deadline) {
+      Thread::YieldCPU();
+    }
+  }
+};
+
+// older event wins (greedy/timestamp policy), so that each event eventually
+// becomes the oldest one and commits
+class TimestampPriority : public ContentionManager {
+ public:
+  TimestampPriority() : ContentionManager("priority") {}
+
+  virtual bool MayAbort(uint32_t committer, uint32_t other) {
+    // tickets wrap around
+    return static_cast<int32_t>(other - committer) > 0;
+  }
+};
+
+// event aborted too many times runs alone, others wait before starting
+// their attempts and the event waits for running attempts to finish
+class SerializeAfterAborts : public ContentionManager {
+ public:
+  SerializeAfterAborts() :
+    ContentionManager("serialize"),
+    serial_mutex_(OS::CreateMutex()),
+    serial_(0),
+    running_(0) {
+  }
+
+  virtual ~SerializeAfterAborts() {
+    delete serial_mutex_;
+  }
+
+  virtual void BeforeAttempt(int attempt) {
+    if (IsSerial(attempt)) {
+      // one serial event at a time
+      serial_mutex_->Lock();
+      NoBarrier_Store(&serial_, 1);
+      MemoryBarrier();
+      while (Acquire_Load(&running_) > 0) {
+        Thread::YieldCPU();
+      }
+      return;
+    }
+
+    while (true) {
+      while (Acquire_Load(&serial_) != 0) {
+        Thread::YieldCPU();
+      }
+      Barrier_AtomicIncrement(&running_, 1);
+      if (Acquire_Load(&serial_) == 0) {
+        return;
+      }
+      // serial event came first, let it run
+      Barrier_AtomicIncrement(&running_, -1);
+    }
+  }
+
+  virtual void AfterAttempt(int attempt, bool committed) {
+    if (IsSerial(attempt)) {
+      Release_Store(&serial_, 0);
+      serial_mutex_->Unlock();
+    } else {
+      Barrier_AtomicIncrement(&running_, -1);
+    }
+  }
+
+ private:
+  bool IsSerial(int attempt) {
+    return attempt >= FLAG_stm_serialize_after;
+  }
+
+  Mutex* serial_mutex_;
+  volatile Atomic32 serial_;
+  volatile Atomic32 running_;
+};
+
+ContentionManager* ContentionManager::New(const char* policy) {
+  if (strcmp(policy, "none") == 0) {
+    return new ImmediateRetry();
+  }
+  if (strcmp(policy, "backoff") == 0) {
+    return new ExponentialBackoff();
+  }
+  if (strcmp(policy, "priority") == 0) {
+    return new TimestampPriority();
+  }
+  if (strcmp(policy, "serialize") == 0) {
+    return new SerializeAfterAborts();
+  }
+  return NULL;
+}
+
+bool ContentionManager::IsPolicy(const char* policy) {
+  ContentionManager* manager = New(policy);
+  delete manager;
+  return manager != NULL;
+}
+
+} } // namespace v8::internal
@@ -0,0 +1,70 @@
+#ifndef V8_STM_CONTENTION_H_
+#define V8_STM_CONTENTION_H_
+
+#include "globals.h"
+#include "platform.h"
+
+namespace v8 {
+namespace internal {
+
+// decides when an aborted event is attempted again and which of two
+// conflicting transactions wins
+// - BeforeAttempt/AfterAttempt bracket each attempt of an event, attempt is
+//   0 for the first one, BeforeAttempt may delay or block the thread (it is
+//   never called inside transaction)
+// - priorities are tickets taken at the first attempt of an event, smaller
+//   ticket is older event
+// - statistics are collected for every policy so that they can be compared
+//   on the same workload
+//
+// policies (--stm-contention)
+// - none: retry immediately, committer always wins
+// - backoff: retry after randomized exponential delay
+// - priority: older event wins, younger committer aborts itself
+// - serialize: event aborted --stm-serialize-after times runs alone
+
+class ContentionManager {
+ public:
+  static ContentionManager* New(const char* policy);
+  static bool IsPolicy(const char* policy);
+
+  virtual ~ContentionManager();
+
+  virtual void BeforeAttempt(int attempt) {}
+  virtual void AfterAttempt(int attempt, bool committed) {}
+
+  // whether committing transaction may abort conflicting one, committer
+  // aborts itself otherwise
+  virtual bool MayAbort(uint32_t committer, uint32_t other) { return true; }
+
+  // latency is measured from the start of the first attempt
+  void RecordCommit(int64_t latency);
+  // wasted is duration of the attempt, zombie is time it kept running after
+  // other transaction aborted it
+  void RecordAbort(int64_t wasted, int64_t zombie);
+  void RecordWait(int64_t wait);
+  void PrintStatistics();
+
+  const char* name() const { return name_; }
+
+ protected:
+  explicit ContentionManager(const char* name);
+
+ private:
+  const char* name_;
+
+  Mutex* statistics_mutex_;
+  int commits_;
+  int aborts_;
+  int64_t total_latency_;
+  int64_t max_latency_;
+  int64_t total_wait_;
+  int64_t total_wasted_;
+  int64_t total_zombie_;
+
+  DISALLOW_COPY_AND_ASSIGN(ContentionManager);
+};
+
+} } // namespace v8::internal
+
+#endif // V8_STM_CONTENTION_H_
@@ -0,0 +1,395 @@
+#ifndef V8_STM_INDEX_H_
+#define V8_STM_INDEX_H_
+
+#include "globals.h"
+#include "allocation.h"
+#include "utils.h"
+
+namespace v8 {
+namespace internal {
+
+class Object;
+
+// a cell of transaction read or write set
+// - from_ is the original object
+// - to_ is the object transaction works with (the same object or a copy)
+// - handles point to to_ so cells must never move
+// - state_ and first_slot_ describe which slots were accessed (see SlotSet)
+struct CellPair {
+  Object* from_;
+  Object* to_;
+  int state_;
+  int first_slot_;
+};
+
+// hash of object address or cell location used by index and signature
+inline uint32_t CellHash(void* key) {
+  // addresses are aligned, drop the bits that are always zero
+  return ComputeIntegerHash(static_cast<uint32_t>(
+      reinterpret_cast<uintptr_t>(key) >> kPointerSizeLog2));
+}
+
+// flat open-addressing (linear probing) index over cells, designed with the
+// following objectives:
+// - no allocation per entry, one cache line per probe in the common case
+// - storage is kept by Clear() so that it is reused by the next transaction
+// - keys are read through the cell, so when GC moves objects only positions
+//   become stale and Rehash() fixes them in place without allocation
+//
+// the index either maps original object address to cell (kByObject) or
+// answers whether a handle location is one of our cells (kByLocation)
+
+class CellIndex {
+ public:
+  enum KeyKind { kByObject, kByLocation };
+
+  explicit CellIndex(KeyKind kind) :
+    kind_(kind), entries_(NULL), capacity_(0), occupancy_(0) {
+    Resize(kInitialCapacity);
+  }
+
+  ~CellIndex() {
+    DeleteArray(entries_);
+  }
+
+  CellPair* Lookup(void* key) const {
+    uint32_t mask = capacity_ - 1;
+    for (uint32_t i = Hash(key) & mask; ; i = (i + 1) & mask) {
+      CellPair* pair = entries_[i];
+      if (pair == NULL) return NULL;
+      if (KeyOf(pair) == key) return pair;
+    }
+  }
+
+  void Insert(CellPair* pair) {
+    ASSERT(Lookup(KeyOf(pair)) == NULL);
+    // keep load factor under 1/2 so that probe sequences stay short
+    if (2 * (occupancy_ + 1) > capacity_) {
+      Resize(2 * capacity_);
+    }
+    Place(pair);
+    occupancy_++;
+  }
+
+  // forgets all entries but keeps the storage
+  void Clear() {
+    if (occupancy_ == 0) return;
+    memset(entries_, 0, capacity_ * sizeof(entries_[0]));
+    occupancy_ = 0;
+  }
+
+  // restores the invariant after keys of some cells were changed (by GC)
+  // entries are tagged as pending and then re-placed one by one, a pending
+  // entry found on the probe path is swapped out and placed next
+  // - placed entries never move again, so their probe paths (which consist
+  //   of placed entries only) stay valid
+  void Rehash() {
+    if (kind_ == kByLocation) return;  // cells don't move
+
+    for (uint32_t i = 0; i < capacity_; i++) {
+      if (entries_[i] != NULL) entries_[i] = Tag(entries_[i]);
+    }
+
+    uint32_t mask = capacity_ - 1;
+    for (uint32_t start = 0; start < capacity_; start++) {
+      if (!IsTagged(entries_[start])) continue;
+
+      CellPair* pair = Untag(entries_[start]);
+      entries_[start] = NULL;
+
+      while (pair != NULL) {
+        uint32_t i = Hash(KeyOf(pair)) & mask;
+        while (entries_[i] != NULL && !IsTagged(entries_[i])) {
+          i = (i + 1) & mask;
+        }
+        CellPair* displaced = entries_[i];
+        entries_[i] = pair;
+        pair = (displaced != NULL) ? Untag(displaced) : NULL;
+      }
+    }
+  }
+
+  uint32_t occupancy() const { return occupancy_; }
+  uint32_t capacity() const { return capacity_; }
+
+ private:
+  static const uint32_t kInitialCapacity = 256;
+
+  void* KeyOf(CellPair* pair) const {
+    if (kind_ == kByObject) return pair->from_;
+    return &pair->to_;
+  }
+
+  static uint32_t Hash(void* key) {
+    return CellHash(key);
+  }
+
+  static CellPair* Tag(CellPair* pair) {
+    return reinterpret_cast<CellPair*>(reinterpret_cast<uintptr_t>(pair) | 1);
+  }
+
+  static CellPair* Untag(CellPair* pair) {
+    return reinterpret_cast<CellPair*>(reinterpret_cast<uintptr_t>(pair) & ~1);
+  }
+
+  static bool IsTagged(CellPair* pair) {
+    return (reinterpret_cast<uintptr_t>(pair) & 1) != 0;
+  }
+
+  void Place(CellPair* pair) {
+    uint32_t mask = capacity_ - 1;
+    uint32_t i = Hash(KeyOf(pair)) & mask;
+    while (entries_[i] != NULL) {
+      i = (i + 1) & mask;
+    }
+    entries_[i] = pair;
+  }
+
+  void Resize(uint32_t new_capacity) {
+    ASSERT(IsPowerOf2(new_capacity));
+    CellPair** old_entries = entries_;
+    uint32_t old_capacity = capacity_;
+
+    entries_ = NewArray<CellPair*>(new_capacity);
+    memset(entries_, 0, new_capacity * sizeof(entries_[0]));
+    capacity_ = new_capacity;
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+      if (old_entries[i] != NULL) Place(old_entries[i]);
+    }
+    DeleteArray(old_entries);
+  }
+
+  KeyKind kind_;
+  CellPair** entries_;
+  uint32_t capacity_;
+  uint32_t occupancy_;
+
+  DISALLOW_COPY_AND_ASSIGN(CellIndex);
+};
+
+// compact bit signature of a set of object addresses (Bloom filter with one
+// hash function), designed for conflict detection at commit:
+// - disjoint sets are ruled out by a few word ANDs or, when one set is much
+//   larger, by looking up keys of the smaller set (see CellMap::MayIntersect)
+// - false positives are possible so a hit must be confirmed by exact check
+// - there are no false negatives as long as signature is rebuilt when GC
+//   moves objects
+// - size grows with the set (kBitsPerKey bits per key) so that large read
+//   sets don't saturate it, the owner rebuilds it when IsCrowded()
+//
+// index uses low bits of the hash, so signature takes high bits
+
+class CellSignature {
+ public:
+  CellSignature() : bits_(NULL), capacity_(0), size_log2_(0), count_(0) {
+    Reset(0);
+  }
+
+  ~CellSignature() {
+    DeleteArray(bits_);
+  }
+
+  void Add(void* key) {
+    uint32_t bit = Bit(key);
+    bits_[bit / kBitsPerPointer] |=
+        static_cast<uintptr_t>(1) << (bit % kBitsPerPointer);
+    count_++;
+  }
+
+  bool Contains(void* key) const {
+    uint32_t bit = Bit(key);
+    return (bits_[bit / kBitsPerPointer] &
+            (static_cast<uintptr_t>(1) << (bit % kBitsPerPointer))) != 0;
+  }
+
+  // signatures of different size can only be compared by Contains
+  bool SameSize(const CellSignature& other) const {
+    return size_log2_ == other.size_log2_;
+  }
+
+  bool MayIntersect(const CellSignature& other) const {
+    ASSERT(SameSize(other));
+    for (int i = 0; i < words(); i++) {
+      if ((bits_[i] & other.bits_[i]) != 0) return true;
+    }
+    return false;
+  }
+
+  // whether the keys should be added again to a signature sized for them
+  bool IsCrowded() const {
+    return size_log2_ < kMaxSizeLog2 && count_ * kBitsPerKey > size();
+  }
+
+  // forgets all keys, the signature is sized for the given number of keys
+  // (storage of larger signatures is kept)
+  void Reset(int expected_count) {
+    if (count_ > 0) {
+      memset(bits_, 0, words() * sizeof(bits_[0]));
+    }
+    count_ = 0;
+
+    size_log2_ = kMinSizeLog2;
+    while (size_log2_ < kMaxSizeLog2 && expected_count * kBitsPerKey > size()) {
+      size_log2_++;
+    }
+
+    if (words() > capacity_) {
+      DeleteArray(bits_);
+      capacity_ = words();
+      bits_ = NewArray<uintptr_t>(capacity_);
+      memset(bits_, 0, capacity_ * sizeof(bits_[0]));
+    }
+  }
+
+  void Clear() {
+    Reset(0);
+  }
+
+  int count() const { return count_; }
+  int size() const { return 1 << size_log2_; }
+
+ private:
+  static const int kBitsPerKey = 64;
+  static const int kMinSizeLog2 = 12;
+  static const int kMaxSizeLog2 = 24;
+
+  uint32_t Bit(void* key) const {
+    return CellHash(key) >> (32 - size_log2_);
+  }
+
+  int words() const { return size() / kBitsPerPointer; }
+
+  uintptr_t* bits_;
+  int capacity_;  // in words
+  int size_log2_;
+  int count_;
+
+  DISALLOW_COPY_AND_ASSIGN(CellSignature);
+};
+
+// slots (property fields and elements) of cells accessed by transaction
+// - entries of one cell are linked into a list starting at first_slot_
+// - lookup by (cell, slot) goes through open-addressing index, cells don't
+//   move so it never needs rehashing
+// - storage is kept by Clear() like in CellIndex
+
+struct SlotEntry {
+  CellPair* cell_;
+  int slot_;
+  int mode_;
+  int next_;  // index of next entry of the same cell or -1
+};
+
+class SlotSet {
+ public:
+  SlotSet() :
+    entries_(NULL), length_(0), entries_capacity_(0),
+    index_(NULL), index_capacity_(0) {
+    GrowEntries(kInitialCapacity);
+    GrowIndex(2 * kInitialCapacity);
+  }
+
+  ~SlotSet() {
+    DeleteArray(entries_);
+    DeleteArray(index_);
+  }
+
+  SlotEntry* Find(CellPair* cell, int slot) {
+    uint32_t mask = index_capacity_ - 1;
+    for (uint32_t i = Hash(cell, slot) & mask; ; i = (i + 1) & mask) {
+      int entry = index_[i];
+      if (entry < 0) return NULL;
+      SlotEntry* result = &entries_[entry];
+      if (result->cell_ == cell && result->slot_ == slot) return result;
+    }
+  }
+
+  // returns existing entry or a new one with zero mode
+  SlotEntry* FindOrAdd(CellPair* cell, int slot) {
+    SlotEntry* result = Find(cell, slot);
+    if (result != NULL) return result;
+
+    if (length_ == entries_capacity_) {
+      GrowEntries(2 * entries_capacity_);
+    }
+    if (2 * (length_ + 1) > index_capacity_) {
+      GrowIndex(2 * index_capacity_);
+    }
+
+    int entry = length_++;
+    result = &entries_[entry];
+    result->cell_ = cell;
+    result->slot_ = slot;
+    result->mode_ = 0;
+    result->next_ = cell->first_slot_;
+    cell->first_slot_ = entry;
+    Place(entry);
+    return result;
+  }
+
+  SlotEntry* First(CellPair* cell) {
+    return cell->first_slot_ < 0 ? NULL : &entries_[cell->first_slot_];
+  }
+
+  SlotEntry* Next(SlotEntry* entry) {
+    return entry->next_ < 0 ? NULL : &entries_[entry->next_];
+  }
+
+  void Clear() {
+    if (length_ == 0) return;
+    memset(index_, -1, index_capacity_ * sizeof(index_[0]));
+    length_ = 0;
+  }
+
+  int length() const { return length_; }
+
+ private:
+  static const int kInitialCapacity = 64;
+
+  static uint32_t Hash(CellPair* cell, int slot) {
+    return CellHash(cell) ^ ComputeIntegerHash(static_cast<uint32_t>(slot));
+  }
+
+  void Place(int entry) {
+    uint32_t mask = index_capacity_ - 1;
+    uint32_t i = Hash(entries_[entry].cell_, entries_[entry].slot_) & mask;
+    while (index_[i] >= 0) {
+      i = (i + 1) & mask;
+    }
+    index_[i] = entry;
+  }
+
+  void GrowEntries(int new_capacity) {
+    SlotEntry* new_entries = NewArray<SlotEntry>(new_capacity);
+    if (entries_ != NULL) {
+      memcpy(new_entries, entries_, length_ * sizeof(entries_[0]));
+      DeleteArray(entries_);
+    }
+    entries_ = new_entries;
+    entries_capacity_ = new_capacity;
+  }
+
+  void GrowIndex(int new_capacity) {
+    ASSERT(IsPowerOf2(new_capacity));
+    DeleteArray(index_);
+    index_ = NewArray<int>(new_capacity);
+    index_capacity_ = new_capacity;
+    memset(index_, -1, index_capacity_ * sizeof(index_[0]));
+    for (int entry = 0; entry < length_; entry++) {
+      Place(entry);
+    }
+  }
+
+  SlotEntry* entries_;
+  int length_;
+  int entries_capacity_;
+  int* index_;
+  int index_capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(SlotSet);
+};
+
+} } // namespace v8::internal
+
+#endif // V8_STM_INDEX_H_
@@ -1,10 +1,10 @@
 #include "v8.h"
 #include "stm.h"
+#include "stm-index.h"
+#include "stm-contention.h"
+#include "hashmap.h"
 #include "isolate.h"
 
-#include <set>
-#include <map>
-
 namespace v8 {
 namespace internal {
 
@@ -16,8 +16,12 @@ namespace internal {
 // - supports updates of object addresses from GC
 //
 // notes:
-// - current implementaion is not optimized yet (N^2 complexity!)
+// - lookups go through flat open-addressing indexes (see stm-index.h)
+// - bit signature of original addresses allows to skip exact intersection
+// - blocks and index storage are kept when transaction is reset so that
+//   the next transaction on the same thread doesn't allocate them again
 // - cell can point to the same object (in read set) or to a copy (write set)
+// - cell state and slots accessed through it are managed by transaction
 // - original address and mapped cell in read set point to the same object
 // - both original object and our copy are retained in memory by our pointers
 // - all cells are destroyed when transaction ends (no need for handle scopes)
@@ -27,7 +31,10 @@ namespace internal {
 class CellMap {
  public:
   CellMap() :
-    first_block_(NULL), last_block_address_(&first_block_) {
+    first_block_(NULL), last_block_address_(&first_block_), index_(0),
+    stale_(false),
+    object_index_(CellIndex::kByObject),
+    location_index_(CellIndex::kByLocation) {
   }
 
   ~CellMap() {
@@ -43,79 +50,58 @@ class CellMap {
     last_block_address_ = &first_block_;
   }
 
-  void RebuildObjectMap() {
-    object_map_.clear();
-
-    Block* block = first_block_;
-
-    while (block != NULL && block != *last_block_address_) {
-      for (int i = 0; i < BLOCK_SIZE; i++) {
-        CellPair& pair = block->cells_[i];
-        object_map_.insert(ObjectMap::value_type(pair.from_, &pair.to_));
-      }
-      block = block->next_;
-    }
-
-    if (block != NULL) { // last block
-      for (int i = 0; i < index_; i++) {
-        CellPair& pair = block->cells_[i];
-        object_map_.insert(ObjectMap::value_type(pair.from_, &pair.to_));
-      }
-    }
+  // forget all cells but keep the memory for reuse
+  void Clear() {
+    last_block_address_ = &first_block_;
+    index_ = 0;
+    stale_ = false;
+    object_index_.Clear();
+    location_index_.Clear();
+    signature_.Clear();
   }
 
+  // object index and signature are left stale when addresses change, GC
+  // pause is shorter if each thread refreshes its own sets (see Refresh)
+  // - location_index_ doesn't need invalidation because cells don't move
   void Iterate(ObjectVisitor* v) {
-    // notes:
-    // - location_set_ doesn't need invalidation because cells don't move
-
-    bool changes = false;
-
     Block* block = first_block_;
 
     while (block != NULL && block != *last_block_address_) {
       for (int i = 0; i < BLOCK_SIZE; i++) {
-        CellPair& pair = block->cells_[i];
-        Object* old_from = pair.from_;
-
-        v->VisitPointer(&pair.from_);
-        v->VisitPointer(&pair.to_);
-
-        changes = changes || (pair.from_ != old_from);
+        IterateCell(&block->cells_[i], v);
       }
       block = block->next_;
     }
 
     if (block != NULL) { // last block
       for (int i = 0; i < index_; i++) {
-        CellPair& pair = block->cells_[i];
-        Object* old_from = pair.from_;
-
-        v->VisitPointer(&pair.from_);
-        v->VisitPointer(&pair.to_);
-
-        changes = changes || (pair.from_ != old_from);
+        IterateCell(&block->cells_[i], v);
       }
     }
+  }
 
-    if (changes) {
-      RebuildObjectMap();
+  // must be called after GC before the map is searched or intersected
+  void Refresh() {
+    if (!stale_) {
+      return;
     }
-  }
 
-  bool IsMapped(Object** location) {
-    return location_set_.find(location) != location_set_.end();
+    // signature is rebuilt from scratch because addresses changed
+    RebuildSignature();
+    object_index_.Rehash();
+    stale_ = false;
   }
 
-  Object** GetMapping(Object* object) {
-    ObjectMap::const_iterator it = object_map_.find(object);
-    if (it != object_map_.end()) {
-      return it->second;
-    }
+  CellPair* FindByLocation(Object** location) {
+    return location_index_.Lookup(location);
+  }
 
-    return NULL;
+  CellPair* FindByObject(Object* object) {
+    ASSERT(!stale_);
+    return object_index_.Lookup(object);
   }
 
-  Object** AddMapping(Object* object, Object* redirect) {
+  CellPair* AddMapping(Object* object, Object* redirect) {
     if (*last_block_address_ == NULL) {
       *last_block_address_ = (Block*)malloc(sizeof(Block));
       (*last_block_address_)->next_ = NULL;
@@ -126,79 +112,76 @@ class CellMap {
     CellPair& pair = (*last_block_address_)->cells_[index_];
     pair.from_ = object;
     pair.to_ = redirect;
+    pair.state_ = 0;
+    pair.first_slot_ = -1;
     index_++;
 
-    location_set_.insert(&pair.to_);
-    object_map_.insert(ObjectMap::value_type(object, &pair.to_));
+    object_index_.Insert(&pair);
+    location_index_.Insert(&pair);
+    signature_.Add(object);
+    if (signature_.IsCrowded()) {
+      RebuildSignature();
+    }
 
-    // block is full
+    // block is full (next block may be kept from previous transaction)
     if (index_ == BLOCK_SIZE) {
       last_block_address_ = &(*last_block_address_)->next_;
+      index_ = 0;
     }
 
-    return &pair.to_;
+    return &pair;
   }
 
-  void CommitChanges(Heap* heap) {
+  // calls visitor->VisitCell(pair) for each cell until it returns false
+  template <typename CellVisitor>
+  bool VisitCells(CellVisitor* visitor) {
     Block* block = first_block_;
 
     while (block != NULL && block != *last_block_address_) {
       for (int i = 0; i < BLOCK_SIZE; i++) {
-        CellPair& pair = block->cells_[i];
-        ASSERT(pair.from_->IsHeapObject());
-        ASSERT(pair.to_->IsHeapObject());
-        Address dst = reinterpret_cast<HeapObject*>(pair.from_)->address();
-        Address src = reinterpret_cast<HeapObject*>(pair.to_)->address();
-        int size = reinterpret_cast<HeapObject*>(pair.from_)->Size();
-        heap->CopyBlock(dst, src, size);
+        if (!visitor->VisitCell(&block->cells_[i])) {
+          return false;
+        }
       }
       block = block->next_;
     }
 
     if (block != NULL) { // last block
       for (int i = 0; i < index_; i++) {
-        CellPair& pair = block->cells_[i];
-        ASSERT(pair.from_->IsHeapObject());
-        ASSERT(pair.to_->IsHeapObject());
-        Address dst = reinterpret_cast<HeapObject*>(pair.from_)->address();
-        Address src = reinterpret_cast<HeapObject*>(pair.to_)->address();
-        int size = reinterpret_cast<HeapObject*>(pair.from_)->Size();
-        heap->CopyBlock(dst, src, size);
+        if (!visitor->VisitCell(&block->cells_[i])) {
+          return false;
+        }
       }
     }
-  }
 
-  bool Intersects(const CellMap& other) {
-    Block* block = other.first_block_;
+    return true;
+  }
 
-    while (block != NULL && block != *other.last_block_address_) {
-      for (int i = 0; i < BLOCK_SIZE; i++) {
-        CellPair& pair = block->cells_[i];
-        if (GetMapping(pair.from_) != NULL) {
-          return true;
-        }
-      }
-      block = block->next_;
+  // false means that sets have no common objects for sure
+  // - signatures of similar sets have the same size and are ANDed
+  // - otherwise keys of the smaller set are looked up in the signature of
+  //   the larger one, which a small signature would not rule out
+  bool MayIntersect(CellMap* other) {
+    ASSERT(!stale_ && !other->stale_);
+    if (signature_.SameSize(other->signature_)) {
+      return signature_.MayIntersect(other->signature_);
     }
 
-    if (block != NULL) { // last block
-      for (int i = 0; i < other.index_; i++) {
-        CellPair& pair = block->cells_[i];
-        if (GetMapping(pair.from_) != NULL) {
-          return true;
-        }
-      }
+    CellMap* smaller = this;
+    CellMap* larger = other;
+    if (smaller->signature_.size() > larger->signature_.size()) {
+      smaller = other;
+      larger = this;
     }
+    SignatureProbe probe(&larger->signature_);
+    return !smaller->VisitCells(&probe);
+  }
 
-    return false;
+  bool IsEmpty() {
+    return object_index_.occupancy() == 0;
   }
 
  private:
-  struct CellPair {
-    Object* from_;
-    Object* to_;
-  };
-
   const static int BLOCK_SIZE = 100;
 
   struct Block {
@@ -206,15 +189,58 @@ class CellMap {
     Block* next_;
   };
 
+  class SignatureBuilder {
+   public:
+    SignatureBuilder(CellSignature* signature, int count) :
+      signature_(signature) {
+      signature_->Reset(count);
+    }
+
+    bool VisitCell(CellPair* pair) {
+      signature_->Add(pair->from_);
+      return true;
+    }
+
+   private:
+    CellSignature* signature_;
+  };
+
+  // stops at the first key the signature may contain
+  class SignatureProbe {
+   public:
+    explicit SignatureProbe(const CellSignature* signature) :
+      signature_(signature) {}
+
+    bool VisitCell(CellPair* pair) {
+      return !signature_->Contains(pair->from_);
+    }
+
+   private:
+    const CellSignature* signature_;
+  };
+
+  void RebuildSignature() {
+    SignatureBuilder builder(&signature_, object_index_.occupancy());
+    VisitCells(&builder);
+  }
+
+  void IterateCell(CellPair* pair, ObjectVisitor* v) {
+    Object* old_from = pair->from_;
+
+    v->VisitPointer(&pair->from_);
+    v->VisitPointer(&pair->to_);
+
+    stale_ = stale_ || (pair->from_ != old_from);
+  }
+
   Block*  first_block_;
   Block** last_block_address_;
   int index_;
+  bool stale_;
 
-  typedef std::set<Object**> LocationSet;
-  typedef std::map<Object*, Object**> ObjectMap;
-
-  LocationSet location_set_;
-  ObjectMap object_map_;
+  CellIndex object_index_;
+  CellIndex location_index_;
+  CellSignature signature_;
 };
 
 class WriteSet {
@@ -225,36 +251,47 @@ class WriteSet {
     map_.Iterate(v);
   }
 
-  Handle<Object> Get(Handle<Object> obj) {
+  void Refresh() {
+    map_.Refresh();
+  }
+
+  CellPair* Get(Handle<Object> obj) {
     // 1) it is our handle (already redirected)
-    if (map_.IsMapped(obj.location())) {
-      return obj;
+    CellPair* cell = map_.FindByLocation(obj.location());
+    if (cell != NULL) {
+      return cell;
     }
 
     // 2) we have a cell for the address of a copy of this object
-    Object** location = map_.GetMapping(*obj);
-    if (location != NULL) {
-      return Handle<Object>(location);
-    }
+    return map_.FindByObject(*obj);
+  }
 
-    return Handle<Object>::null();
+  CellPair* Find(Object* original) {
+    return map_.FindByObject(original);
   }
 
-  Handle<Object> Add(Handle<Object> obj, Object* redirect) {
+  CellPair* Add(Handle<Object> obj, Object* redirect) {
     // create a cell for the redirected object
-    Object** location = map_.AddMapping(*obj, redirect);
-    ASSERT_NOT_NULL(location);
-    return Handle<Object>(location);
+    return map_.AddMapping(*obj, redirect);
   }
 
-  void CommitChanges(Heap* heap) {
-    map_.CommitChanges(heap);
+  bool MayIntersect(WriteSet* other) {
+    return map_.MayIntersect(&other->map_);
   }
 
-  bool Intersects(const WriteSet& other) {
-    return map_.Intersects(other.map_);
+  bool IsEmpty() {
+    return map_.IsEmpty();
   }
-  
+
+  template <typename CellVisitor>
+  bool VisitCells(CellVisitor* visitor) {
+    return map_.VisitCells(visitor);
+  }
+
+  void Clear() {
+    map_.Clear();
+  }
+
  private:
   CellMap map_;
 
@@ -267,96 +304,481 @@ class ReadSet {
     map_.Iterate(v);
   }
 
-  Handle<Object> Get(Handle<Object> obj) {
+  void Refresh() {
+    map_.Refresh();
+  }
+
+  CellPair* Get(Handle<Object> obj) {
     // 1) it is our handle (already redirected)
-    if (map_.IsMapped(obj.location())) {
-      return obj;
+    CellPair* cell = map_.FindByLocation(obj.location());
+    if (cell != NULL) {
+      return cell;
     }
 
     // 2) we have our own handle for this object
-    Object** location = map_.GetMapping(*obj);
-    if (location != NULL) {
-      return Handle<Object>(location);
-    }
+    return map_.FindByObject(*obj);
+  }
 
-    return Handle<Object>::null();
+  CellPair* Find(Object* original) {
+    return map_.FindByObject(original);
   }
 
-  Handle<Object> Add(Handle<Object> obj) {
+  CellPair* Add(Handle<Object> obj) {
+    return Add(*obj);
+  }
+
+  CellPair* Add(Object* obj) {
     // create handle pointing to the same object
-    Object** location = map_.AddMapping(*obj, *obj);
-    ASSERT_NOT_NULL(location);
-    return Handle<Object>(location);
+    return map_.AddMapping(obj, obj);
+  }
+
+  bool MayIntersect(WriteSet* other) {
+    return map_.MayIntersect(&other->map_);
   }
 
-  bool Intersects(const WriteSet& other) {
-    return map_.Intersects(other.map_);
+  template <typename CellVisitor>
+  bool VisitCells(CellVisitor* visitor) {
+    return map_.VisitCells(visitor);
+  }
+
+  void Clear() {
+    map_.Clear();
   }
 
  private:
   CellMap map_;
 };
 
+// version records for objects used with --stm-version-clock (TL2 scheme)
+// - record is found by hashing object address (several objects may share it)
+// - record holds version of last commit that wrote the object and lock bit
+// - objects moved by GC get record of their new address, transactions that
+//   validate against records carry versions over (see Transaction::Iterate),
+//   newer version of the new record may only cause a false conflict
+// - classic commits keep records current too once read-only transactions
+//   (which validate against them) are used
+class VersionTable {
+ public:
+  VersionTable() : records_(NewArray<Atomic32>(kRecords)) {
+    memset(records_, 0, kRecords * sizeof(records_[0]));
+  }
+
+  Atomic32* RecordFor(Object* obj) {
+    return &records_[CellHash(obj) & (kRecords - 1)];
+  }
+
+  static bool IsLocked(Atomic32 record) { return (record & 1) != 0; }
+  static Atomic32 VersionOf(Atomic32 record) { return record >> 1; }
+  static Atomic32 Unlocked(Atomic32 version) { return version << 1; }
+
+  // called by GC only, records are not locked then
+  static void Raise(Atomic32* record, Atomic32 version) {
+    if (VersionOf(*record) < version) {
+      *record = Unlocked(version);
+    }
+  }
+
+ private:
+  static const int kRecords = 1 << 18;
+
+  Atomic32* records_;
+};
+
+// previous versions of committed objects kept for snapshot readers (--stm-mvcc)
+// - commit adds state of each written object before the commit, it is valid
+//   until write version of the commit
+// - reader with read version rv needs the oldest version valid until a
+//   version newer than rv (versions of an object are kept newest first)
+// - versions no reader can need are dropped at GC, others are roots
+class SnapshotTable {
+ public:
+  SnapshotTable() : map_(Match), mutex_(OS::CreateMutex()) {}
+
+  void Add(Object* original, Object* copy, Atomic32 end_version) {
+    ScopedLock lock(mutex_);
+    HashMap::Entry* entry = map_.Lookup(original, CellHash(original), true);
+    ObjectVersion* version = new ObjectVersion;
+    version->copy_ = copy;
+    version->end_version_ = end_version;
+    version->next_ = static_cast<ObjectVersion*>(entry->value);
+    entry->value = version;
+  }
+
+  // returns NULL if the object didn't change after read version
+  Object* Find(Object* original, Atomic32 read_version) {
+    ScopedLock lock(mutex_);
+    HashMap::Entry* entry = map_.Lookup(original, CellHash(original), false);
+    if (entry == NULL) {
+      return NULL;
+    }
+
+    Object* result = NULL;
+    for (ObjectVersion* version = static_cast<ObjectVersion*>(entry->value);
+         version != NULL && version->end_version_ > read_version;
+         version = version->next_) {
+      result = version->copy_;
+    }
+    return result;
+  }
+
+  // called by GC only
+  // - drops versions valid until oldest read version of running readers
+  // - rebuilds the map because originals may move and carries their newest
+  //   versions to the records of new addresses
+  void Iterate(ObjectVisitor* v, Atomic32 oldest_read_version,
+               VersionTable* versions) {
+    List<HashMap::Entry> entries;
+    for (HashMap::Entry* p = map_.Start(); p != NULL; p = map_.Next(p)) {
+      ObjectVersion* chain = Prune(static_cast<ObjectVersion*>(p->value),
+                                   oldest_read_version);
+      if (chain != NULL) {
+        HashMap::Entry entry = { p->key, chain, 0 };
+        entries.Add(entry);
+      }
+    }
+    map_.Clear();
+
+    for (int i = 0; i < entries.length(); i++) {
+      Object* original = static_cast<Object*>(entries[i].key);
+      ObjectVersion* chain = static_cast<ObjectVersion*>(entries[i].value);
+
+      v->VisitPointer(&original);
+      for (ObjectVersion* version = chain;
+           version != NULL;
+           version = version->next_) {
+        v->VisitPointer(&version->copy_);
+      }
+
+      map_.Lookup(original, CellHash(original), true)->value = chain;
+      VersionTable::Raise(versions->RecordFor(original), chain->end_version_);
+    }
+  }
+
+ private:
+  struct ObjectVersion {
+    Object* copy_;
+    Atomic32 end_version_;
+    ObjectVersion* next_;
+  };
+
+  static bool Match(void* key1, void* key2) {
+    return key1 == key2;
+  }
+
+  // returns the rest of the chain
+  static ObjectVersion* Prune(ObjectVersion* chain, Atomic32 oldest) {
+    ObjectVersion** link = &chain;
+    while (*link != NULL && (*link)->end_version_ > oldest) {
+      link = &(*link)->next_;
+    }
+
+    ObjectVersion* version = *link;
+    *link = NULL;
+    while (version != NULL) {
+      ObjectVersion* next = version->next_;
+      delete version;
+      version = next;
+    }
+    return chain;
+  }
+
+  HashMap map_;
+  Mutex* mutex_;
+};
+
+// slots are tracked so that transactions accessing different fields or
+// elements of the same object don't conflict
+// - non-negative slot is field index (see JSObject::FastPropertyAt)
+// - negative slot encodes element index of fast elements
+// - access that cannot be attributed to a slot makes whole object accessed
+// - loads of absent properties depend only on object layout, they conflict
+//   with stores that change layout (these are whole object stores)
+static const int kWholeObjectSlot = kMinInt;
+static const int kLayoutSlot = kMinInt + 1;
+
+// cell states
+static const int kWholeObject = 1 << 0;  // access not attributed to slot
+static const int kStaleCopy = 1 << 1;    // original changed after copying
+static const int kSharedElements = 1 << 2;    // copy uses original elements
+static const int kSharedProperties = 1 << 3;  // and properties
+
+// slot entry modes
+static const int kSlotRead = 1 << 0;
+static const int kSlotWrite = 1 << 1;
+static const int kSlotStale = 1 << 2;    // committed by other transaction
+
+static int ElementSlot(uint32_t index) {
+  return -static_cast<int>(index) - 1;
+}
+
+static bool IsElementSlot(int slot) {
+  return slot < 0 && slot != kWholeObjectSlot && slot != kLayoutSlot;
+}
+
+static int ElementIndex(int slot) {
+  return -(slot + 1);
+}
+
+static int SlotFor(JSObject* object, Object* key, bool is_store) {
+  uint32_t index;
+  if (key->ToArrayIndex(&index) ||
+      (key->IsString() && String::cast(key)->AsArrayIndex(&index))) {
+    if (!object->HasFastTypeElements() && !object->HasFastDoubleElements()) {
+      return kWholeObjectSlot;
+    }
+
+    uint32_t length = object->IsJSArray() ?
+        static_cast<uint32_t>(Smi::cast(JSArray::cast(object)->length())->value()) :
+        static_cast<uint32_t>(object->elements()->length());
+    if (index < length) {
+      return ElementSlot(index);
+    }
+
+    // stores beyond length change length and maybe elements store
+    return is_store ? kWholeObjectSlot : kLayoutSlot;
+  }
+
+  if (!key->IsString() || !object->HasFastProperties()) {
+    return kWholeObjectSlot;
+  }
+
+  String* name = String::cast(key);
+  if (object->IsJSArray() && !is_store &&
+      name->Equals(object->GetHeap()->length_symbol())) {
+    return kLayoutSlot;
+  }
+
+  LookupResult lookup;
+  object->LocalLookup(name, &lookup);
+  if (!lookup.IsProperty()) {
+    // absent or inherited property, stores add it to the object
+    return is_store ? kWholeObjectSlot : kLayoutSlot;
+  }
+
+  switch (lookup.type()) {
+    case FIELD:
+      return lookup.GetFieldIndex();
+    case CONSTANT_FUNCTION:
+      // value is in the map
+      return is_store ? kWholeObjectSlot : kLayoutSlot;
+    default:
+      return kWholeObjectSlot;
+  }
+}
+
 class Transaction {
  public:
   Transaction(Isolate* isolate) :
     aborted_(false),
+    attempt_(0),
+    priority_(0),
+    started_(0),
+    attempt_started_(0),
+    doomed_at_(0),
+    read_only_(false),
+    wrote_(false),
+    versions_(NULL),
+    read_version_(0),
+    snapshots_(NULL),
+    allocation_depth_(0),
+    allocation_start_(NULL),
+    copying_(false),
     isolate_(isolate),
+    thread_index_(Heap::ThreadIndex()),
+    stack_guard_(isolate->stack_guard()),
     mutex_(OS::CreateMutex()),
-    gc_mutex_(OS::CreateMutex()),
-    done_gc_(NULL) {
-    gc_mutex_->Lock();
+    gc_state_(kRunning),
+    gc_resume_(OS::CreateSemaphore(0)),
+    gc_task_(NULL) {
+    memset(recent_reads_, 0, sizeof(recent_reads_));
+  }
+
+  ~Transaction() {
+    delete mutex_;
+    delete gc_resume_;
+  }
+
+  // prepare finished transaction for reuse by the next one on this thread
+  // (it is running as after construction)
+  void Reset() {
+    ASSERT(gc_state_ == kRunning);
+    read_set_.Clear();
+    write_set_.Clear();
+    slots_.Clear();
+    read_log_.Rewind(0);
+    memset(recent_reads_, 0, sizeof(recent_reads_));
+    snapshot_copies_.Rewind(0);
+    snapshot_records_.Rewind(0);
+    locked_records_.Rewind(0);
+    accumulator_updates_.Rewind(0);
+    local_ranges_.Rewind(0);
+    aborted_ = false;
   }
 
   void Iterate(ObjectVisitor* v) {
+    // local objects may be moved or promoted, they are treated as shared
+    // from now on
+    local_ranges_.Rewind(0);
+    allocation_start_ = NULL;
+
+    for (int i = 0; i < accumulator_updates_.length(); i++) {
+      v->VisitPointer(&accumulator_updates_[i].holder_);
+    }
+
+    if (snapshot_copies_.length() > 0) {
+      v->VisitPointers(&snapshot_copies_[0],
+                       &snapshot_copies_[0] + snapshot_copies_.length());
+    }
+
+    if (versions_ == NULL) {
+      read_set_.Iterate(v);
+      write_set_.Iterate(v);
+      return;
+    }
+
+    // objects may move to addresses with older version records, versions
+    // seen before GC are carried to the new records so that validation
+    // doesn't miss commits made before the move
+    carried_versions_.Rewind(0);
+    VersionCarrier collector(this, false);
+    CarryVersions(&collector);
+
     read_set_.Iterate(v);
     write_set_.Iterate(v);
+    if (read_log_.length() > 0) {
+      v->VisitPointers(&read_log_[0], &read_log_[0] + read_log_.length());
+    }
+    memset(recent_reads_, 0, sizeof(recent_reads_));
+
+    VersionCarrier raiser(this, true);
+    CarryVersions(&raiser);
+  }
+
+  // rebuilds indexes of sets after GC, done by the transaction's own thread
+  // when it was paused (see STM::LeaveCollectionScope)
+  void RefreshSets() {
+    read_set_.Refresh();
+    write_set_.Refresh();
   }
 
-  Handle<Object> RedirectLoad(Handle<Object> obj, bool* terminate) {
+  // key is property name or element index, null key means that the whole
+  // object is accessed
+  Handle<Object> RedirectLoad(Handle<Object> obj, Handle<Object> key,
+                              bool* terminate) {
     ASSERT(!obj.is_null());
 
-    if (!obj->IsJSObject() || obj->IsJSFunction()) {
+    if (read_only_ && !IsLocal(*obj)) {
+      return snapshots_ != NULL ?
+          LoadSnapshot(obj) : LoadReadOnly(obj, terminate);
+    }
+
+    CellPair* cell = RedirectLoadCell(obj, terminate);
+    if (cell == NULL) {
       return obj;
     }
 
-    if (aborted_) {
+    int slot = SlotOf(cell, key, kSlotRead);
+    if (!RecordAccess(cell, slot, kSlotRead)) {
+      aborted_ = true;
+      *terminate = true;
+      return obj;
+    }
+
+    // whole object can be modified by the caller (e.g. by builtin)
+    if (slot == kWholeObjectSlot && !MakeWritable(cell, slot)) {
+      FATAL("Cannot copy backing store");
+    }
+
+    return Handle<Object>(&cell->to_);
+  }
+
+  Handle<Object> RedirectStore(Handle<Object> obj, Handle<Object> key,
+                               bool* terminate) {
+    ASSERT(!obj.is_null());
+
+    CellPair* cell = RedirectStoreCell(obj, terminate);
+    if (cell == NULL) {
+      return obj;
+    }
+
+    int slot = SlotOf(cell, key, kSlotWrite);
+    if (!RecordAccess(cell, slot, kSlotWrite)) {
+      aborted_ = true;
       *terminate = true;
       return obj;
     }
 
+    if (!MakeWritable(cell, slot)) {
+      FATAL("Cannot copy backing store");
+    }
+
+    return Handle<Object>(&cell->to_);
+  }
+
+  // returns cell redirecting the object or NULL if it is not tracked
+  CellPair* RedirectLoadCell(Handle<Object> obj, bool* terminate) {
+    if (!obj->IsJSObject() || obj->IsJSFunction()) {
+      return NULL;
+    }
+
+    if (aborted_) {
+      *terminate = true;
+      return NULL;
+    }
+
+    if (IsLocal(*obj)) {
+      return NULL;
+    }
+
     // lookup in write set and redirect if included
-    Handle<Object> redirect = write_set_.Get(obj);
-    if (!redirect.is_null())
-      return redirect;
+    CellPair* cell = write_set_.Get(obj);
+    if (cell != NULL)
+      return cell;
 
     // lookup in read set and return if included
-    redirect = read_set_.Get(obj);
-    if (!redirect.is_null())
-      return redirect;
+    cell = read_set_.Get(obj);
+    if (cell != NULL)
+      return cell;
+
+    // object committed after we started, don't work with inconsistent data
+    if (!CheckVersion(*obj)) {
+      aborted_ = true;
+      *terminate = true;
+      return NULL;
+    }
 
     // include in read set and return
     ScopedLock lock(mutex_);
     return read_set_.Add(obj);
   }
 
-  Handle<Object> RedirectStore(Handle<Object> obj, bool* terminate) {
-    ASSERT(!obj.is_null());
-
+  CellPair* RedirectStoreCell(Handle<Object> obj, bool* terminate) {
     // TODO: handle functions too (Heap::CopyJSObject doesn't accept them)
     if (!obj->IsJSObject() || obj->IsJSFunction()) {
-      return obj;
+      return NULL;
     }
 
     if (aborted_) {
       *terminate = true;
-      return obj;
+      return NULL;
+    }
+
+    if (IsLocal(*obj)) {
+      return NULL;
+    }
+
+    if (read_only_) {
+      // declared read-only but writes, next attempt runs as read-write
+      wrote_ = true;
+      aborted_ = true;
+      *terminate = true;
+      return NULL;
     }
 
     // lookup in write set and return if included
-    Handle<Object> redirect = write_set_.Get(obj);
-    if (!redirect.is_null()) {
-      return redirect;
+    CellPair* cell = write_set_.Get(obj);
+    if (cell != NULL) {
+      return cell;
     }
 
     // make a copy
@@ -365,42 +787,574 @@ class Transaction {
       FATAL("Cannot create object copy");
       aborted_ = true;
       *terminate = true;
-      return obj;
+      return NULL;
+    }
+
+    // the copy may already be inconsistent
+    if (!CheckVersion(*obj)) {
+      aborted_ = true;
+      *terminate = true;
+      return NULL;
     }
 
     // include it in write set and return
     ScopedLock lock(mutex_);
-    return write_set_.Add(obj, copy);
+    cell = write_set_.Add(obj, copy);
+    if (copy->elements()->length() > 0 &&
+        copy->elements()->map() != isolate_->heap()->fixed_cow_array_map()) {
+      cell->state_ |= kSharedElements;
+    }
+    if (copy->properties()->length() > 0) {
+      cell->state_ |= kSharedProperties;
+    }
+    return cell;
   }
 
-  JSObject* CreateCopy(Handle<Object> obj) {
-    // obj will be included in the root list becuase it is used on stack
-    CALL_AND_RETRY(isolate_,
-      isolate_->heap()->CopyJSObject(JSObject::cast(*obj)),
-      return JSObject::cast(__object__),
-      return NULL);
+  // read-only transaction works with originals, it doesn't build read set
+  // and only logs objects for validation against version records at commit
+  Handle<Object> LoadReadOnly(Handle<Object> obj, bool* terminate) {
+    if (!obj->IsJSObject() || obj->IsJSFunction()) {
+      return obj;
+    }
+
+    if (aborted_ || !CheckVersion(*obj)) {
+      aborted_ = true;
+      *terminate = true;
+      return obj;
+    }
+
+    LogRead(*obj);
+    return obj;
   }
 
-  void CommitHeap() {
-    // copy all objects included in write set back to their original location
-    Heap* heap = isolate_->heap();
-    write_set_.CommitChanges(heap);
+  void LogRead(Object* obj) {
+    // objects read repeatedly are logged once in most cases
+    Object** recent = &recent_reads_[CellHash(obj) & (kRecentReads - 1)];
+    if (*recent != obj) {
+      *recent = obj;
+      read_log_.Add(obj);
+    }
   }
 
-  bool HasConflicts(Transaction* other) {
-    if (read_set_.Intersects(other->write_set_))
-      return true;
+  // barriers of IC stubs (see STM::LoadBarrier) work like RedirectLoad and
+  // RedirectStore of a field but never allocate on the heap, NULL means
+  // that the access must go through IC miss (it may copy or abort)
+  Object* LoadBarrier(Object* obj, int slot) {
+    if (!obj->IsJSObject() || obj->IsJSFunction() || IsLocal(obj)) {
+      return obj;
+    }
 
-    if (write_set_.Intersects(other->write_set_))
-      return true;
+    if (aborted_) {
+      return NULL;
+    }
 
-    return false;
+    if (read_only_) {
+      // snapshot reader needs the runtime only for changed objects
+      if (!CheckVersion(obj)) {
+        return NULL;
+      }
+      LogRead(obj);
+      return obj;
+    }
+
+    CellPair* cell = write_set_.Find(obj);
+    if (cell == NULL) {
+      cell = read_set_.Find(obj);
+    }
+    if (cell == NULL) {
+      if (!CheckVersion(obj)) {
+        return NULL;
+      }
+      ScopedLock lock(mutex_);
+      cell = read_set_.Add(obj);
+    }
+
+    return RedirectField(cell, obj, slot, kSlotRead);
   }
 
-  void Lock() { mutex_->Lock(); }
-  void Unlock() { mutex_->Unlock(); }
+  Object* StoreBarrier(Object* obj, int slot) {
+    if (!obj->IsJSObject() || obj->IsJSFunction() || IsLocal(obj)) {
+      return obj;
+    }
+
+    if (aborted_ || read_only_) {
+      return NULL;
+    }
+
+    // creating the copy allocates
+    CellPair* cell = write_set_.Find(obj);
+    if (cell == NULL) {
+      return NULL;
+    }
+
+    if (slot == STM::kTransitionSlot) {
+      slot = kWholeObjectSlot;
+    }
+    if (!IsWritable(cell, slot)) {
+      return NULL;
+    }
+
+    return RedirectField(cell, obj, slot, kSlotWrite);
+  }
+
+  Object* RedirectField(CellPair* cell, Object* obj, int slot, int mode) {
+    // stub checked the map of the original, its field index is valid for
+    // the copy only if the copy has the same map
+    if (HeapObject::cast(cell->to_)->map() != HeapObject::cast(obj)->map()) {
+      return NULL;
+    }
+
+    if (!RecordAccess(cell, slot, mode)) {
+      aborted_ = true;
+      return NULL;
+    }
+    return cell->to_;
+  }
+
+  // whether MakeWritable has nothing to copy
+  bool IsWritable(CellPair* cell, int slot) {
+    if ((cell->state_ & kSharedElements) != 0 &&
+        (slot == kWholeObjectSlot || IsElementSlot(slot))) {
+      return false;
+    }
+    if ((cell->state_ & kSharedProperties) != 0 &&
+        (slot == kWholeObjectSlot ||
+         (!IsElementSlot(slot) &&
+          slot >= JSObject::cast(cell->to_)->map()->inobject_properties()))) {
+      return false;
+    }
+    return true;
+  }
+
+  // snapshot reader sees objects as of its read version
+  // - each load finds the version, so later commits are not visible
+  // - original is read after the load returns, a commit may land in between,
+  //   so originals are logged and validated at commit like in LoadReadOnly
+  //   (reader aborts only if an object it read in place was written)
+  Handle<Object> LoadSnapshot(Handle<Object> obj) {
+    if (!obj->IsJSObject() || obj->IsJSFunction()) {
+      return obj;
+    }
+
+    // commit in progress, it doesn't wait for anything
+    Atomic32* record = versions_->RecordFor(*obj);
+    Atomic32 value;
+    while (VersionTable::IsLocked(value = Acquire_Load(record))) {
+      Thread::YieldCPU();
+    }
+
+    if (VersionTable::VersionOf(value) <= read_version_) {
+      LogRead(*obj);
+      return obj;
+    }
+
+    // object may only share the record with other committed object, it is
+    // logged too and the retry takes newer read version
+    Object* copy = snapshots_->Find(*obj, read_version_);
+    if (copy != NULL) {
+      return Handle<Object>(copy);
+    }
+    LogRead(*obj);
+    return obj;
+  }
+
+  int SlotOf(CellPair* cell, Handle<Object> key, int mode) {
+    if (key.is_null()) {
+      return kWholeObjectSlot;
+    }
+    return SlotFor(JSObject::cast(cell->to_), *key, mode == kSlotWrite);
+  }
+
+  // attributes access to a slot of the object, returns false if we'd see
+  // a slot overwritten by other commit after we copied the object
+  bool RecordAccess(CellPair* cell, int slot, int mode) {
+    // committers inspect our slots
+    ScopedLock lock(mutex_);
+
+    if (slot == kWholeObjectSlot) {
+      cell->state_ |= kWholeObject;
+      return (cell->state_ & kStaleCopy) == 0;
+    }
+
+    if (slot == kLayoutSlot) {
+      return true;
+    }
+
+    SlotEntry* entry = slots_.FindOrAdd(cell, slot);
+    entry->mode_ |= mode;
+    return mode == kSlotWrite || (entry->mode_ & kSlotStale) == 0;
+  }
+
+  // backing stores are shared with the original until the copy writes
+  // into them, so a single element store doesn't copy whole array
+  JSObject* CreateCopy(Handle<Object> obj) {
+    CopyScope copy_scope(this);
+    // obj will be included in the root list becuase it is used on stack
+    CALL_AND_RETRY(isolate_,
+      isolate_->heap()->CopyJSObjectShallow(JSObject::cast(*obj)),
+      return JSObject::cast(__object__),
+      return NULL);
+  }
+
+  // gives the copy own backing store containing the slot
+  bool MakeWritable(CellPair* cell, int slot) {
+    if (slot == kLayoutSlot) {
+      return true;
+    }
+
+    if ((cell->state_ & kSharedElements) != 0 &&
+        (slot == kWholeObjectSlot || IsElementSlot(slot))) {
+      FixedArrayBase* elements = CopyElements(cell);
+      if (elements == NULL) {
+        return false;
+      }
+      // committers set kStaleCopy under our mutex (see MarkStale), copying
+      // above may pause for GC so it is done without the lock
+      ScopedLock lock(mutex_);
+      JSObject::cast(cell->to_)->set_elements(elements);
+      cell->state_ &= ~kSharedElements;
+    }
+
+    if ((cell->state_ & kSharedProperties) != 0 &&
+        (slot == kWholeObjectSlot ||
+         (!IsElementSlot(slot) &&
+          slot >= JSObject::cast(cell->to_)->map()->inobject_properties()))) {
+      FixedArray* properties = CopyProperties(cell);
+      if (properties == NULL) {
+        return false;
+      }
+      // same as for elements above
+      ScopedLock lock(mutex_);
+      JSObject::cast(cell->to_)->set_properties(properties);
+      cell->state_ &= ~kSharedProperties;
+    }
+
+    return true;
+  }
+
+  // cell is updated by GC, so the copy is read again on retry
+  FixedArrayBase* CopyElements(CellPair* cell) {
+    if (JSObject::cast(cell->to_)->HasFastDoubleElements()) {
+      CALL_AND_RETRY(isolate_,
+        isolate_->heap()->CopyFixedDoubleArray(
+            FixedDoubleArray::cast(JSObject::cast(cell->to_)->elements())),
+        return FixedArrayBase::cast(__object__),
+        return NULL);
+    }
+
+    CALL_AND_RETRY(isolate_,
+      isolate_->heap()->CopyFixedArray(
+          FixedArray::cast(JSObject::cast(cell->to_)->elements())),
+      return FixedArrayBase::cast(__object__),
+      return NULL);
+  }
+
+  FixedArray* CopyProperties(CellPair* cell) {
+    CALL_AND_RETRY(isolate_,
+      isolate_->heap()->CopyFixedArray(
+          JSObject::cast(cell->to_)->properties()),
+      return FixedArray::cast(__object__),
+      return NULL);
+  }
+
+  // decides which copies must be written back as whole objects, returns
+  // false if such copy is stale (it would overwrite other commit)
+  bool PrepareCommit() {
+    WriteBackPreparer preparer(this);
+    return write_set_.VisitCells(&preparer);
+  }
+
+  void CommitHeap() {
+    // accumulators first, so that whoever sees our writes sees our updates
+    ApplyAccumulators();
+
+    // copy objects or their written slots back to their original location
+    WriteBack write_back(this);
+    write_set_.VisitCells(&write_back);
+  }
+
+  // classic commit keeps version records current for read-only
+  // transactions, commits are serialized so only snapshots can be stale
+  bool LockRecords(VersionTable* versions) {
+    RecordLocker locker(this, versions);
+    if (!write_set_.VisitCells(&locker) || !CheckSnapshots(versions)) {
+      ReleaseRecords(false, 0);
+      return false;
+    }
+    return true;
+  }
+
+  void RestoreRecords() {
+    ReleaseRecords(false, 0);
+  }
+
+  void CommitHeapVersioned(SnapshotTable* snapshots,
+                           volatile Atomic32* clock) {
+    CommitHeap();
+    Atomic32 write_version = Barrier_AtomicIncrement(clock, 1);
+    PublishSnapshots(snapshots, write_version);
+    ReleaseRecords(true, write_version);
+  }
+
+  // objects allocated by transaction in new space are invisible to others
+  // until it commits, so their loads and stores bypass read and write sets
+  // - thread allocates from its own buffer, so new space allocated in an
+  //   allocation scope belongs to this transaction
+  // - buffers are usually carved in increasing order, ranges out of order
+  //   make older ranges forgotten
+  // - ranges are forgotten at GC, copies are never local
+  void EnterAllocationScope(Address top) {
+    if (allocation_depth_++ == 0) {
+      allocation_start_ = top;
+    }
+  }
+
+  void LeaveAllocationScope(Address top) {
+    if (--allocation_depth_ > 0) {
+      return;
+    }
+
+    AddLocalRange(allocation_start_, top);
+    allocation_start_ = NULL;
+  }
+
+  // buffer is exhausted, the scope continues in the next one
+  void SwitchAllocationBuffer(Address top, Address start) {
+    if (allocation_depth_ == 0) {
+      return;
+    }
+
+    AddLocalRange(allocation_start_, top);
+    allocation_start_ = start;
+  }
+
+  void AddLocalRange(Address start, Address top) {
+    if (start == NULL || top <= start || copying_) {
+      return;
+    }
+
+    if (!local_ranges_.is_empty()) {
+      AllocationRange& last = local_ranges_.last();
+      if (last.end_ == start) {
+        last.end_ = top;
+        return;
+      }
+      if (last.end_ > start) {
+        local_ranges_.Rewind(0);
+      }
+    }
+
+    AllocationRange range = { start, top };
+    local_ranges_.Add(range);
+  }
+
+  bool IsLocal(Object* obj) {
+    if (local_ranges_.is_empty() || !obj->IsHeapObject()) {
+      return false;
+    }
+
+    Address address = HeapObject::cast(obj)->address();
+    if (address < local_ranges_[0].start_ ||
+        address >= local_ranges_.last().end_) {
+      return false;
+    }
+
+    // last range starting at or below the address
+    int low = 0;
+    int high = local_ranges_.length() - 1;
+    while (low < high) {
+      int middle = (low + high + 1) / 2;
+      if (local_ranges_[middle].start_ <= address) {
+        low = middle;
+      } else {
+        high = middle - 1;
+      }
+    }
+    return address < local_ranges_[low].end_;
+  }
+
+  void LogAccumulate(Handle<Object> holder, Accumulator* accumulator,
+                     Accumulator::Operation op, double operand) {
+    AccumulatorUpdate update = { *holder, accumulator, op, operand };
+    accumulator_updates_.Add(update);
+  }
+
+  // committed value with our updates
+  double PendingValue(Accumulator* accumulator, double value) {
+    for (int i = 0; i < accumulator_updates_.length(); i++) {
+      AccumulatorUpdate& update = accumulator_updates_[i];
+      if (update.accumulator_ == accumulator) {
+        value = Accumulator::Apply(update.op_, value, update.operand_);
+      }
+    }
+    return value;
+  }
+
+  // called once the transaction is sure to commit
+  void ApplyAccumulators() {
+    for (int i = 0; i < accumulator_updates_.length(); i++) {
+      AccumulatorUpdate& update = accumulator_updates_[i];
+      update.accumulator_->Update(update.op_, update.operand_);
+    }
+    accumulator_updates_.Rewind(0);
+  }
+
+  // MVCC, copies of originals are taken before commit because it cannot
+  // allocate, the copy is consistent if the record didn't change meanwhile
+  void TakeSnapshots(VersionTable* versions) {
+    SnapshotTaker taker(this, versions);
+    write_set_.VisitCells(&taker);
+  }
+
+  // originals must not change between taking snapshots and locking
+  bool CheckSnapshots(VersionTable* versions) {
+    int index = 0;
+    SnapshotChecker checker(this, versions, &index);
+    return write_set_.VisitCells(&checker);
+  }
+
+  void PublishSnapshots(SnapshotTable* snapshots, Atomic32 write_version) {
+    if (snapshots == NULL || snapshot_copies_.length() == 0) {
+      return;
+    }
+    SnapshotPublisher publisher(this, snapshots, write_version);
+    write_set_.VisitCells(&publisher);
+  }
+
+  // transaction that wrote nothing has nothing to lock and nobody can
+  // conflict with it, it only checks that what it read is still current
+  bool WroteNothing() {
+    return write_set_.IsEmpty();
+  }
+
+  bool ValidateReadOnly() {
+    if (aborted_ || versions_ == NULL) {
+      // classic transaction is validated by committers
+      return !aborted_;
+    }
+
+    for (int i = 0; i < read_log_.length(); i++) {
+      if (!IsCurrent(versions_->RecordFor(read_log_[i]))) {
+        return false;
+      }
+    }
+
+    RecordValidator validator(this);
+    return read_set_.VisitCells(&validator);
+  }
+
+  // global version clock mode (TL2)
+  // - read version is the clock value when transaction starts
+  // - any object with version record newer than that is a conflict
+  // - commit locks records of its write set, validates both sets against
+  //   read version and releases the records with new clock value
+  // - commit never waits for other transactions, it aborts itself instead
+
+  // versions are NULL unless transaction validates against them (in TL2
+  // mode or when it is read-only), snapshots are given to snapshot readers
+  void StartVersioned(VersionTable* versions, Atomic32 read_version,
+                      SnapshotTable* snapshots) {
+    versions_ = versions;
+    read_version_ = read_version;
+    snapshots_ = snapshots;
+  }
+
+  bool IsSnapshotReader() { return snapshots_ != NULL; }
+  Atomic32 read_version() { return read_version_; }
+
+  bool CheckVersion(Object* obj) {
+    if (versions_ == NULL) {
+      return true;
+    }
+
+    return IsCurrent(versions_->RecordFor(obj));
+  }
+
+  bool IsCurrent(Atomic32* record) {
+    Atomic32 value = Acquire_Load(record);
+    return !VersionTable::IsLocked(value) &&
+           VersionTable::VersionOf(value) <= read_version_;
+  }
+
+  bool CommitVersioned(volatile Atomic32* clock, SnapshotTable* snapshots) {
+    RecordLocker locker(this, versions_);
+    if (!write_set_.VisitCells(&locker) || !CheckSnapshots(versions_)) {
+      ReleaseRecords(false, 0);
+      return false;
+    }
+
+    // nobody could commit in between if clock moves by one
+    Atomic32 write_version = Barrier_AtomicIncrement(clock, 1);
+    if (write_version != read_version_ + 1) {
+      RecordValidator validator(this);
+      if (!read_set_.VisitCells(&validator) ||
+          !write_set_.VisitCells(&validator)) {
+        ReleaseRecords(false, 0);
+        return false;
+      }
+    }
+
+    if (!PrepareCommit()) {
+      ReleaseRecords(false, 0);
+      return false;
+    }
+
+    CommitHeap();
+    PublishSnapshots(snapshots, write_version);
+    ReleaseRecords(true, write_version);
+    return true;
+  }
+
+  // checks whether commit of other transaction overwrites slots we've
+  // accessed, if not then our copies of its objects are marked stale
+  // (unless the commit is only considered)
+  bool HasConflicts(Transaction* other, bool mark_stale = true) {
+    if (!read_set_.MayIntersect(&other->write_set_) &&
+        !write_set_.MayIntersect(&other->write_set_)) {
+      return false;
+    }
+
+    ConflictChecker checker(this, other, mark_stale);
+    return !other->write_set_.VisitCells(&checker);
+  }
+
+  // the first attempt of an event takes new priority, retries keep it
+  // event declared read-only runs as read-write after it tried to write
+  void StartAttempt(int attempt, uint32_t priority, bool read_only) {
+    attempt_ = attempt;
+    attempt_started_ = OS::Ticks();
+    doomed_at_ = 0;
+    if (attempt == 0) {
+      priority_ = priority;
+      started_ = attempt_started_;
+      wrote_ = false;
+    }
+    read_only_ = read_only && !wrote_;
+  }
+
+  bool IsReadOnly() { return read_only_; }
+
+  int attempt() { return attempt_; }
+  uint32_t priority() { return priority_; }
+  int64_t started() { return started_; }
+  int64_t attempt_started() { return attempt_started_; }
+  int64_t doomed_at() { return doomed_at_; }
+
+  void Lock() { mutex_->Lock(); }
+  void Unlock() { mutex_->Unlock(); }
   
   void Abort() { aborted_ = true; }
+
+  // aborts transaction running in other thread, the thread is interrupted
+  // at the next function entry or loop back edge (see StackGuard)
+  void Doom() {
+    if (aborted_) {
+      return;
+    }
+    aborted_ = true;
+    doomed_at_ = OS::Ticks();
+    stack_guard_->RequestSTMAbort(thread_index_);
+  }
   bool IsAborted() { return aborted_; }
 
   void ClearExceptions() {
@@ -408,46 +1362,521 @@ class Transaction {
     isolate_->clear_pending_message();
   }
 
-  void LockGC() { gc_mutex_->Lock(); }
-  void UnlockGC() { gc_mutex_->Unlock(); }
+  // safepoint states (see STM::EnterCollectionScope)
+  // - kRunning: thread may access the heap, GC waits until it leaves
+  // - kSafe: thread is blocked outside the heap (e.g. in commit)
+  // - kHeld, kHeldWaiting: safe thread is held by GC, in the latter state it
+  //   already tried to leave and waits to be resumed
+  // - kPaused: thread waits for GC and helps with its tasks
+  enum GCState { kRunning, kSafe, kHeld, kHeldWaiting, kPaused };
+
+  Atomic32 gc_state() { return Acquire_Load(&gc_state_); }
+
+  // the store is followed by barrier, so that the thread sees GC flag set
+  // before it or GC sees the new state
+  void SetGCState(GCState state) {
+    NoBarrier_Store(&gc_state_, state);
+    MemoryBarrier();
+  }
 
-  void ResetDoneGC() {
-    ASSERT(done_gc_ == NULL);
-    done_gc_ = OS::CreateSemaphore(0);
+  bool ChangeGCState(GCState from, GCState to) {
+    return NoBarrier_CompareAndSwap(&gc_state_, from, to) == from;
   }
 
-  void WaitDoneGC() {
-    ASSERT_NOT_NULL(done_gc_);
-    done_gc_->Wait();
-    delete done_gc_;
-    done_gc_ = NULL;
+  // interrupts running JavaScript at the next function entry or loop back
+  // edge, so that thread reaches safepoint even if it doesn't allocate
+  void RequestSafepoint() {
+    stack_guard_->RequestSTMSafepoint(thread_index_);
   }
 
-  void SignalDoneGC() {
-    if (done_gc_ != NULL) {
-      done_gc_->Signal();
-    }
+  // parked threads wait on their own semaphore, it is woken up with task
+  // to help with or with NULL when GC is done
+  GCTask* Park() {
+    gc_resume_->Wait();
+    GCTask* task = gc_task_;
+    gc_task_ = NULL;
+    return task;
   }
 
+  void Unpark(GCTask* task) {
+    gc_task_ = task;
+    gc_resume_->Signal();
+  }
+
+  bool IsPausedForGC() { return gc_state() == kPaused; }
+
+  int thread_index() { return thread_index_; }
+
  private:
+  // true if other transaction writing the cell overwrites our accesses
+  bool Overlaps(CellPair* cell, Transaction* other, CellPair* written) {
+    if ((cell->state_ & kWholeObject) != 0 ||
+        (written->state_ & kWholeObject) != 0) {
+      return true;
+    }
+
+    for (SlotEntry* entry = other->slots_.First(written);
+         entry != NULL;
+         entry = other->slots_.Next(entry)) {
+      if ((entry->mode_ & kSlotWrite) == 0) {
+        continue;
+      }
+      SlotEntry* own = slots_.Find(cell, entry->slot_);
+      if (own != NULL && (own->mode_ & (kSlotRead | kSlotWrite)) != 0) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // remembers slots of our copy overwritten in the original
+  void MarkStale(CellPair* cell, Transaction* other, CellPair* written) {
+    cell->state_ |= kStaleCopy;
+    for (SlotEntry* entry = other->slots_.First(written);
+         entry != NULL;
+         entry = other->slots_.Next(entry)) {
+      if ((entry->mode_ & kSlotWrite) != 0) {
+        slots_.FindOrAdd(cell, entry->slot_)->mode_ |= kSlotStale;
+      }
+    }
+  }
+
+  class ConflictChecker {
+   public:
+    ConflictChecker(Transaction* trans, Transaction* other, bool mark_stale) :
+      trans_(trans), other_(other), mark_stale_(mark_stale) {}
+
+    bool VisitCell(CellPair* written) {
+      CellPair* cell = trans_->read_set_.Find(written->from_);
+      if (cell != NULL && trans_->Overlaps(cell, other_, written)) {
+        return false;
+      }
+
+      cell = trans_->write_set_.Find(written->from_);
+      if (cell != NULL) {
+        if (trans_->Overlaps(cell, other_, written)) {
+          return false;
+        }
+        if (mark_stale_) {
+          trans_->MarkStale(cell, other_, written);
+        }
+      }
+
+      return true;
+    }
+
+   private:
+    Transaction* trans_;
+    Transaction* other_;
+    bool mark_stale_;
+  };
+
+  // copies that changed layout of the object are written back as whole
+  class WriteBackPreparer {
+   public:
+    explicit WriteBackPreparer(Transaction* trans) : trans_(trans) {}
+
+    bool VisitCell(CellPair* cell) {
+      JSObject* original = JSObject::cast(cell->from_);
+      JSObject* copy = JSObject::cast(cell->to_);
+
+      if (original->map() != copy->map() ||
+          original->properties()->length() != copy->properties()->length() ||
+          original->elements()->length() != copy->elements()->length() ||
+          (original->elements()->map() ==
+              original->GetHeap()->fixed_cow_array_map() &&
+           HasElementWrites(cell))) {
+        cell->state_ |= kWholeObject;
+      }
+
+      return (cell->state_ & (kWholeObject | kStaleCopy)) !=
+             (kWholeObject | kStaleCopy);
+    }
+
+   private:
+    bool HasElementWrites(CellPair* cell) {
+      for (SlotEntry* entry = trans_->slots_.First(cell);
+           entry != NULL;
+           entry = trans_->slots_.Next(entry)) {
+        if ((entry->mode_ & kSlotWrite) != 0 && IsElementSlot(entry->slot_)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    Transaction* trans_;
+  };
+
+  class WriteBack {
+   public:
+    explicit WriteBack(Transaction* trans) : trans_(trans) {}
+
+    bool VisitCell(CellPair* cell) {
+      ASSERT(cell->from_->IsHeapObject());
+      ASSERT(cell->to_->IsHeapObject());
+
+      if ((cell->state_ & kWholeObject) != 0) {
+        HeapObject* original = HeapObject::cast(cell->from_);
+        trans_->isolate_->heap()->CopyBlock(
+            original->address(),
+            HeapObject::cast(cell->to_)->address(),
+            original->Size());
+        return true;
+      }
+
+      JSObject* original = JSObject::cast(cell->from_);
+      JSObject* copy = JSObject::cast(cell->to_);
+      for (SlotEntry* entry = trans_->slots_.First(cell);
+           entry != NULL;
+           entry = trans_->slots_.Next(entry)) {
+        if ((entry->mode_ & kSlotWrite) == 0) {
+          continue;
+        }
+
+        if (!IsElementSlot(entry->slot_)) {
+          original->FastPropertyAtPut(entry->slot_,
+                                      copy->FastPropertyAt(entry->slot_));
+        } else if (copy->HasFastDoubleElements()) {
+          int index = ElementIndex(entry->slot_);
+          FixedDoubleArray* from = FixedDoubleArray::cast(copy->elements());
+          FixedDoubleArray* to = FixedDoubleArray::cast(original->elements());
+          if (from->is_the_hole(index)) {
+            to->set_the_hole(index);
+          } else {
+            to->set(index, from->get_scalar(index));
+          }
+        } else {
+          int index = ElementIndex(entry->slot_);
+          FixedArray::cast(original->elements())->set(
+              index, FixedArray::cast(copy->elements())->get(index));
+        }
+      }
+      return true;
+    }
+
+   private:
+    Transaction* trans_;
+  };
+
+  struct LockedRecord {
+    Atomic32* record_;
+    Atomic32 value_;  // value before locking
+  };
+
+  // locks version records of write set cells
+  class RecordLocker {
+   public:
+    RecordLocker(Transaction* trans, VersionTable* versions) :
+      trans_(trans), versions_(versions) {}
+
+    bool VisitCell(CellPair* pair) {
+      Atomic32* record = versions_->RecordFor(pair->from_);
+      Atomic32 value = Acquire_Load(record);
+
+      if (VersionTable::IsLocked(value)) {
+        // record shared by two objects of our write set is fine
+        return trans_->HasLocked(record);
+      }
+
+      if (Acquire_CompareAndSwap(record, value, value | 1) != value) {
+        return false;
+      }
+
+      LockedRecord locked = { record, value };
+      trans_->locked_records_.Add(locked);
+      return true;
+    }
+
+   private:
+    Transaction* trans_;
+    VersionTable* versions_;
+  };
+
+  // collects versions of objects validated by transaction before GC and
+  // raises records of their new addresses after it (in the same order)
+  class VersionCarrier {
+   public:
+    VersionCarrier(Transaction* trans, bool raise) :
+      trans_(trans), raise_(raise), index_(0) {}
+
+    bool VisitCell(CellPair* pair) {
+      Visit(pair->from_);
+      return true;
+    }
+
+    void Visit(Object* obj) {
+      Atomic32* record = trans_->versions_->RecordFor(obj);
+      if (!raise_) {
+        trans_->carried_versions_.Add(VersionTable::VersionOf(*record));
+      } else {
+        VersionTable::Raise(record, trans_->carried_versions_[index_++]);
+      }
+    }
+
+   private:
+    Transaction* trans_;
+    bool raise_;
+    int index_;
+  };
+
+  class SnapshotTaker {
+   public:
+    SnapshotTaker(Transaction* trans, VersionTable* versions) :
+      trans_(trans), versions_(versions) {}
+
+    bool VisitCell(CellPair* pair) {
+      while (true) {
+        Atomic32 value = Acquire_Load(versions_->RecordFor(pair->from_));
+        if (VersionTable::IsLocked(value)) {
+          Thread::YieldCPU();
+          continue;
+        }
+
+        // GC may move the original, the cell is updated
+        Object* copy = trans_->CreateSnapshot(pair);
+        if (copy == NULL) {
+          FATAL("Cannot create object snapshot");
+        }
+
+        if (Acquire_Load(versions_->RecordFor(pair->from_)) == value) {
+          trans_->snapshot_copies_.Add(copy);
+          trans_->snapshot_records_.Add(value);
+          return true;
+        }
+      }
+    }
+
+   private:
+    Transaction* trans_;
+    VersionTable* versions_;
+  };
+
+  class SnapshotChecker {
+   public:
+    SnapshotChecker(Transaction* trans, VersionTable* versions, int* index) :
+      trans_(trans), versions_(versions), index_(index) {}
+
+    bool VisitCell(CellPair* pair) {
+      if (*index_ >= trans_->snapshot_records_.length()) {
+        return true;  // snapshots were not taken
+      }
+      Atomic32* record = versions_->RecordFor(pair->from_);
+      return trans_->LockedValue(record) ==
+             trans_->snapshot_records_[(*index_)++];
+    }
+
+   private:
+    Transaction* trans_;
+    VersionTable* versions_;
+    int* index_;
+  };
+
+  class SnapshotPublisher {
+   public:
+    SnapshotPublisher(Transaction* trans, SnapshotTable* snapshots,
+                      Atomic32 write_version) :
+      trans_(trans), snapshots_(snapshots), write_version_(write_version),
+      index_(0) {}
+
+    bool VisitCell(CellPair* pair) {
+      snapshots_->Add(pair->from_, trans_->snapshot_copies_[index_++],
+                      write_version_);
+      return true;
+    }
+
+   private:
+    Transaction* trans_;
+    SnapshotTable* snapshots_;
+    Atomic32 write_version_;
+    int index_;
+  };
+
+  Object* CreateSnapshot(CellPair* pair) {
+    CopyScope copy_scope(this);
+    // cell is updated by GC, so the original is read again on retry
+    CALL_AND_RETRY(isolate_,
+      isolate_->heap()->CopyJSObject(JSObject::cast(pair->from_)),
+      return __object__,
+      return NULL);
+  }
+
+  // value of record before we locked it
+  Atomic32 LockedValue(Atomic32* record) {
+    for (int i = 0; i < locked_records_.length(); i++) {
+      if (locked_records_[i].record_ == record) {
+        return locked_records_[i].value_;
+      }
+    }
+    UNREACHABLE();
+    return 0;
+  }
+
+  void CarryVersions(VersionCarrier* carrier) {
+    read_set_.VisitCells(carrier);
+    write_set_.VisitCells(carrier);
+    for (int i = 0; i < read_log_.length(); i++) {
+      carrier->Visit(read_log_[i]);
+    }
+  }
+
+  // checks that objects were not committed after transaction started
+  class RecordValidator {
+   public:
+    explicit RecordValidator(Transaction* trans) : trans_(trans) {}
+
+    bool VisitCell(CellPair* pair) {
+      Atomic32* record = trans_->versions_->RecordFor(pair->from_);
+      Atomic32 value = Acquire_Load(record);
+
+      if (VersionTable::IsLocked(value) && !trans_->HasLocked(record)) {
+        return false;
+      }
+
+      return VersionTable::VersionOf(value) <= trans_->read_version_;
+    }
+
+   private:
+    Transaction* trans_;
+  };
+
+  bool HasLocked(Atomic32* record) {
+    for (int i = 0; i < locked_records_.length(); i++) {
+      if (locked_records_[i].record_ == record) return true;
+    }
+    return false;
+  }
+
+  // unlocks records setting new version or restoring the previous one
+  void ReleaseRecords(bool committed, Atomic32 write_version) {
+    for (int i = 0; i < locked_records_.length(); i++) {
+      LockedRecord& locked = locked_records_[i];
+      Release_Store(locked.record_, committed ?
+          VersionTable::Unlocked(write_version) : locked.value_);
+    }
+    locked_records_.Rewind(0);
+  }
+
   volatile bool aborted_;
+
+  // kept when transaction is reused for retry of the same event
+  int attempt_;
+  uint32_t priority_;
+  int64_t started_;
+  int64_t attempt_started_;
+  int64_t doomed_at_;
+
+  // read-only transaction keeps log of objects instead of read set
+  static const int kRecentReads = 64;
+  bool read_only_;
+  bool wrote_;
+  List<Object*> read_log_;
+  Object* recent_reads_[kRecentReads];
+  List<Atomic32> carried_versions_;
+
+  VersionTable* versions_;
+  Atomic32 read_version_;
+  SnapshotTable* snapshots_;
+  List<LockedRecord> locked_records_;
+
+  // copies of originals of write set and their records (MVCC)
+  List<Object*> snapshot_copies_;
+  List<Atomic32> snapshot_records_;
+
+  struct AccumulatorUpdate {
+    Object* holder_;
+    Accumulator* accumulator_;
+    Accumulator::Operation op_;
+    double operand_;
+  };
+
+  List<AccumulatorUpdate> accumulator_updates_;
+
+  struct AllocationRange {
+    Address start_;
+    Address end_;
+  };
+
+  // new space allocated by this transaction
+  int allocation_depth_;
+  Address allocation_start_;
+  bool copying_;
+  List<AllocationRange> local_ranges_;
+
+  class CopyScope {
+   public:
+    explicit CopyScope(Transaction* trans) : trans_(trans) {
+      trans_->copying_ = true;
+    }
+
+    ~CopyScope() {
+      trans_->copying_ = false;
+    }
+
+   private:
+    Transaction* trans_;
+  };
   Isolate* isolate_;
+  int thread_index_;
+  StackGuard* stack_guard_;
   ReadSet read_set_;
   WriteSet write_set_;
+  SlotSet slots_;
   Mutex* mutex_;
-  Mutex* gc_mutex_;
-  Semaphore* done_gc_;
+  volatile Atomic32 gc_state_;
+  Semaphore* gc_resume_;
+  GCTask* gc_task_;
 };
 
+Accumulator::Accumulator(double value) :
+  mutex_(OS::CreateMutex()),
+  value_(value) {
+}
+
+Accumulator::~Accumulator() {
+  delete mutex_;
+}
+
+double Accumulator::value() {
+  ScopedLock lock(mutex_);
+  return value_;
+}
+
+void Accumulator::Update(Operation op, double operand) {
+  ScopedLock lock(mutex_);
+  value_ = Apply(op, value_, operand);
+}
+
+double Accumulator::Apply(Operation op, double value, double operand) {
+  switch (op) {
+    case kAdd:
+      return value + operand;
+    case kMax:
+      return operand > value ? operand : value;
+    case kMin:
+      return operand < value ? operand : value;
+  }
+  UNREACHABLE();
+  return value;
+}
+
 STM::STM() :
   need_gc_(0),
-  heap_mutex_(OS::CreateMutex()),
+  version_clock_(0),
+  versions_(NULL),
+  snapshots_(NULL),
+  contention_(NULL),
+  next_priority_(0),
   commit_mutex_(OS::CreateMutex()),
-  transactions_mutex_(OS::CreateMutex()) {
+  transactions_mutex_(OS::CreateMutex()),
+  safepoint_reached_(OS::CreateSemaphore(0)),
+  gc_helpers_done_(OS::CreateSemaphore(0)) {
+  memset(safepoint_stats_, 0, sizeof(safepoint_stats_));
 }
 
 // we respect the following requirements
-// - all heap modifications (allocs and GCs) should be mutually exclusive
+// - GCs should be mutually exclusive with all other heap modifications
 // - when GC is needed in at least one thread other threads must be stopped in a
 //   safe state (all object pointers are tracked)
 // - when several threads run out of memory at the same time (highly probable
@@ -457,14 +1886,27 @@ STM::STM() :
 // - GC is relatively rare event and it shouldn't slow down everything
 //
 // we implement them in the following way
-// - each transaction has a lock that must be acquired before GC
+// - each transaction has a safepoint state, running transactions must reach
+//   a safepoint before GC
 // - GC thread prevents modification of transactions list via
 //   `transactions_mutex_`
 // - transactions just starting cannot modify heap so we simply block them
-// - committing transactions release GC lock before (possibly) blocking on
-//   `transactions_mutex_`
+// - committing transactions enter safe region before (possibly) blocking on
+//   `transactions_mutex_`, GC holds safe transactions so that they cannot
+//   leave the region until it is done
 // - each thread checks a flag before each allocation and pauses if GC is
-//   required
+//   required, GC also interrupts running JavaScript (see StackGuard) so that
+//   threads which don't allocate pause at the next function entry or loop
+//   back edge
+// - paused threads park on their own semaphore (futex on Linux), it is
+//   created once per transaction, not per GC
+// - threads allocate from their own buffers, shared spaces are locked by
+//   heap (see Heap::AllocateRawLocal)
+// - paused threads help after GC by refreshing indexes of their own read
+//   and write sets, GC thread refreshes the others and waits for helpers
+//   before other transactions can commit (and look at the sets)
+// - GC thread may also run its tasks (e.g. marking) in paused threads, they
+//   are woken up with the task and wait for the next one after it
 
 void STM::EnterAllocationScope() {
   if (!v8::internal::FLAG_stm) {
@@ -472,7 +1914,11 @@ void STM::EnterAllocationScope() {
   }
 
   PauseForGC();
-  heap_mutex_->Lock();
+
+  Transaction* trans = isolate_->get_transaction();
+  if (trans != NULL) {
+    trans->EnterAllocationScope(isolate_->heap()->NewSpaceTop());
+  }
 }
 
 void STM::LeaveAllocationScope() {
@@ -480,9 +1926,21 @@ void STM::LeaveAllocationScope() {
     return;
   }
 
-  heap_mutex_->Unlock();
+  Transaction* trans = isolate_->get_transaction();
+  if (trans != NULL) {
+    trans->LeaveAllocationScope(isolate_->heap()->NewSpaceTop());
+  }
+}
+
+void STM::SwitchAllocationBuffer(Address top, Address start) {
+  Transaction* trans = isolate_->get_transaction();
+  if (trans != NULL) {
+    trans->SwitchAllocationBuffer(top, start);
+  }
 }
 
+// every GC stops all threads, new space is scaled by number of threads (see
+// Heap::ConfigureHeap) so that scavenges are less frequent
 bool STM::EnterCollectionScope() {
   if (!v8::internal::FLAG_stm) {
     return true;
@@ -501,23 +1959,47 @@ bool STM::EnterCollectionScope() {
   // transactions are either blocked by `transactions_mutex_` or paused for GC
   transactions_mutex_->Lock();
 
-  // wait for other threads to pause
+  // bring other threads to safepoint
+  // - safe transactions are held so that they stay out of the heap
+  // - paused transactions stay paused until we wake them up
+  // - running transactions are interrupted and we wait until they pause or
+  //   enter safe region, each of them signals `safepoint_reached_` then
+  // we don't care about newly starting transactions
   Transaction* current_trans = isolate_->get_transaction();
   ASSERT_NOT_NULL(current_trans);
+  int64_t safepoint_requested = OS::Ticks();
   for (int i = 0; i < transactions_.length(); i++) {
     Transaction* trans = transactions_[i];
     if (trans == current_trans) { continue; }
 
-    // if transaction is locked in commit by `transactions_mutex_` then it has
-    // released GC lock already and we are fine, otherwise it will pause for GC
-    // or enter commit eventually
-    // we don't care about newly starting transactions
-    trans->LockGC();
+    bool requested = false;
+    while (true) {
+      Atomic32 state = trans->gc_state();
+      if (state == Transaction::kPaused) {
+        if (requested) {
+          RecordSafepoint(trans, OS::Ticks() - safepoint_requested);
+        }
+        break;
+      }
+      if (state == Transaction::kSafe) {
+        if (trans->ChangeGCState(Transaction::kSafe, Transaction::kHeld)) {
+          if (requested) {
+            RecordSafepoint(trans, OS::Ticks() - safepoint_requested);
+          }
+          break;
+        }
+        continue;
+      }
+      ASSERT(state == Transaction::kRunning);
+      if (!requested) {
+        trans->RequestSafepoint();
+        requested = true;
+      }
+      // signals of threads we don't wait for yet may wake us up early
+      safepoint_reached_->Wait();
+    }
   }
 
-  // TODO(w16): do we need the barrier here?
-  MemoryBarrier();
-
   // do GC
   return true;
 }
@@ -535,68 +2017,249 @@ void STM::LeaveCollectionScope() {
   // signal other threads to resume
   Transaction* current_trans = isolate_->get_transaction();
   ASSERT_NOT_NULL(current_trans);
+  int helpers = 0;
   for (int i = 0; i < transactions_.length(); i++) {
     Transaction* trans = transactions_[i];
     if (trans == current_trans) { continue; }
 
-    // if transaction is paused for GC then we'll release it by SignalDoneGC
-    // if it was blocked by `transactions_mutex_` then we allow it to proceed
-    // after acquiring `transactions_mutex_` by unlocking GC
-    trans->UnlockGC();
-    trans->SignalDoneGC();
+    // paused transaction refreshes its sets itself
+    // held transaction is released and it may proceed to acquire
+    // `transactions_mutex_` when we unlock it
+    if (trans->IsPausedForGC()) {
+      helpers++;
+      trans->Unpark(NULL);
+    } else {
+      trans->RefreshSets();
+      ReleaseHeld(trans);
+    }
+  }
+  current_trans->RefreshSets();
+
+  // sets must be consistent before anybody commits, helpers are running
+  // again when they signal so the next GC sees their state
+  for (int i = 0; i < helpers; i++) {
+    gc_helpers_done_->Wait();
   }
 
   // allow transactions list to be modified
   transactions_mutex_->Unlock();
 }
 
+int STM::GCHelpers() {
+  if (!v8::internal::FLAG_stm) {
+    return 0;
+  }
+
+  // transactions list is locked by GC thread
+  int helpers = 0;
+  for (int i = 0; i < transactions_.length(); i++) {
+    if (transactions_[i]->IsPausedForGC()) {
+      helpers++;
+    }
+  }
+  return helpers;
+}
+
+void STM::RunGCTask(GCTask* task) {
+  int helpers = 0;
+  if (v8::internal::FLAG_stm) {
+    for (int i = 0; i < transactions_.length(); i++) {
+      Transaction* trans = transactions_[i];
+      if (trans->IsPausedForGC()) {
+        trans->Unpark(task);
+        helpers++;
+      }
+    }
+  }
+
+  task->Run();
+
+  for (int i = 0; i < helpers; i++) {
+    gc_helpers_done_->Wait();
+  }
+}
+
 void STM::PauseForGC() {
   if (!need_gc_) {
     return;
   }
 
+  // GC doesn't wait for threads outside transaction (e.g. safepoint request
+  // outlived the transaction)
   Transaction* trans = isolate_->get_transaction();
-  ASSERT_NOT_NULL(trans);
+  if (trans == NULL) {
+    return;
+  }
 
   // signal that we paused
-  trans->ResetDoneGC();
-  trans->UnlockGC();
+  trans->SetGCState(Transaction::kPaused);
+  safepoint_reached_->Signal();
+
+  // wait for GC to complete, helping with its tasks
+  GCTask* task;
+  while ((task = trans->Park()) != NULL) {
+    task->Run();
+    gc_helpers_done_->Signal();
+  }
+  trans->SetGCState(Transaction::kRunning);
+
+  trans->RefreshSets();
+  gc_helpers_done_->Signal();
+}
+
+void STM::EnterSafeRegion(Transaction* trans) {
+  ASSERT(trans->gc_state() == Transaction::kRunning);
+  trans->SetGCState(Transaction::kSafe);
+  if (Acquire_Load(&need_gc_) != 0) {
+    safepoint_reached_->Signal();
+  }
+}
+
+void STM::LeaveSafeRegion(Transaction* trans) {
+  while (!trans->ChangeGCState(Transaction::kSafe, Transaction::kRunning)) {
+    // held by GC, tell it that we wait and park until it is done
+    if (trans->ChangeGCState(Transaction::kHeld, Transaction::kHeldWaiting)) {
+      GCTask* task = trans->Park();
+      ASSERT(task == NULL);
+      USE(task);
+    }
+  }
+  MemoryBarrier();
+}
 
-  // wait for GC to complete
-  trans->WaitDoneGC();
-  trans->LockGC();
+void STM::ReleaseHeld(Transaction* trans) {
+  if (!trans->ChangeGCState(Transaction::kHeld, Transaction::kSafe)) {
+    ASSERT(trans->gc_state() == Transaction::kHeldWaiting);
+    trans->SetGCState(Transaction::kSafe);
+    trans->Unpark(NULL);
+  }
+}
+
+// time to safepoint of a thread that was running when GC was requested,
+// recorded by GC thread
+void STM::RecordSafepoint(Transaction* trans, int64_t latency) {
+  SafepointStatistics* stats = &safepoint_stats_[trans->thread_index()];
+  stats->count++;
+  stats->total_latency += latency;
+  if (latency > stats->max_latency) {
+    stats->max_latency = latency;
+  }
 }
 
 void STM::Iterate(ObjectVisitor* v) {
+  // versions older than any running snapshot reader are not needed
+  Atomic32 oldest_read_version = version_clock_;
   for (int i = 0; i < transactions_.length(); i++) {
-    transactions_[i]->Iterate(v);
+    Transaction* trans = transactions_[i];
+    trans->Iterate(v);
+    if (trans->IsSnapshotReader() &&
+        trans->read_version() < oldest_read_version) {
+      oldest_read_version = trans->read_version();
+    }
+  }
+
+  if (snapshots_ != NULL) {
+    snapshots_->Iterate(v, oldest_read_version, versions_);
+  }
+}
+
+bool STM::IsDoomed() {
+  Transaction* trans = isolate_->get_transaction();
+  return trans != NULL && trans->IsAborted();
+}
+
+Object* STM::LoadBarrier(Isolate* isolate, Object* obj, int slot) {
+  Transaction* trans = isolate->get_transaction();
+  return trans == NULL ? obj : trans->LoadBarrier(obj, slot);
+}
+
+Object* STM::StoreBarrier(Isolate* isolate, Object* obj, int slot) {
+  Transaction* trans = isolate->get_transaction();
+  return trans == NULL ? obj : trans->StoreBarrier(obj, slot);
+}
+
+void STM::Accumulate(Handle<Object> holder, Accumulator* accumulator,
+                     Accumulator::Operation op, double operand) {
+  Transaction* trans = isolate_->get_transaction();
+  if (trans == NULL) {
+    accumulator->Update(op, operand);
+    return;
   }
+
+  trans->LogAccumulate(holder, accumulator, op, operand);
+}
+
+double STM::AccumulatorValue(Accumulator* accumulator) {
+  double value = accumulator->value();
+  Transaction* trans = isolate_->get_transaction();
+  return trans == NULL ? value : trans->PendingValue(accumulator, value);
 }
 
 Handle<Object> STM::RedirectLoad(Handle<Object> obj, bool* terminate) {
+  return RedirectLoad(obj, Handle<Object>::null(), terminate);
+}
+
+Handle<Object> STM::RedirectStore(Handle<Object> obj, bool* terminate) {
+  return RedirectStore(obj, Handle<Object>::null(), terminate);
+}
+
+Handle<Object> STM::RedirectLoad(Handle<Object> obj, Handle<Object> key,
+                                 bool* terminate) {
   Transaction* trans = isolate_->get_transaction();
   if (trans == NULL) {
     return obj;
   }
 
-  return trans->RedirectLoad(obj, terminate);
+  return trans->RedirectLoad(obj, key, terminate);
 }
 
-Handle<Object> STM::RedirectStore(Handle<Object> obj, bool* terminate) {
+Handle<Object> STM::RedirectStore(Handle<Object> obj, Handle<Object> key,
+                                  bool* terminate) {
   Transaction* trans = isolate_->get_transaction();
   if (trans == NULL) {
     return obj;
   }
 
-  return trans->RedirectStore(obj, terminate);
+  return trans->RedirectStore(obj, key, terminate);
 }
 
-void STM::StartTransaction() {
-  Transaction* trans = new Transaction(isolate_);
+void STM::StartTransaction(int attempt, bool read_only) {
+  // may wait, we are not in transaction yet so GC can proceed
+  ContentionManager* contention = GetContentionManager();
+  int64_t wait_start = OS::Ticks();
+  contention->BeforeAttempt(attempt);
+  contention->RecordWait(OS::Ticks() - wait_start);
+
+  // reuse transaction (and memory of its sets) from previous event
+  Transaction* trans = isolate_->get_idle_transaction();
+  if (trans == NULL) {
+    trans = new Transaction(isolate_);
+  } else {
+    isolate_->set_idle_transaction(NULL);
+  }
   isolate_->set_transaction(trans);
+  trans->StartAttempt(attempt, static_cast<uint32_t>(
+      Barrier_AtomicIncrement(&next_priority_, 1)), read_only);
 
   ScopedLock transactions_lock(transactions_mutex_);
   transactions_.Add(trans);
+
+  if (FLAG_stm_mvcc && snapshots_ == NULL) {
+    snapshots_ = new SnapshotTable();
+  }
+
+  if (FLAG_stm_version_clock || FLAG_stm_mvcc || trans->IsReadOnly()) {
+    if (versions_ == NULL) {
+      versions_ = new VersionTable();
+    }
+  }
+
+  if (FLAG_stm_version_clock || trans->IsReadOnly()) {
+    trans->StartVersioned(versions_, Acquire_Load(&version_clock_),
+                          trans->IsReadOnly() ? snapshots_ : NULL);
+  } else {
+    trans->StartVersioned(NULL, 0, NULL);
+  }
 }
 
 bool STM::CommitTransaction() {
@@ -610,17 +2273,46 @@ bool STM::CommitTransaction() {
   }
   even = ! even;
 
+  // copies can't be allocated in commit
+  if (snapshots_ != NULL && !trans->WroteNothing() && !trans->IsAborted()) {
+    trans->TakeSnapshots(versions_);
+  }
+
+  bool comitted;
+  if (trans->WroteNothing()) {
+    comitted = CommitReadOnly(trans);
+  } else if (FLAG_stm_version_clock) {
+    comitted = CommitVersioned(trans);
+  } else {
+    comitted = CommitAndAbortConflicts(trans);
+  }
+
+  // finished transaction keeps attempt data until its thread starts another
+  int64_t now = OS::Ticks();
+  if (comitted) {
+    contention_->RecordCommit(now - trans->started());
+  } else {
+    contention_->RecordAbort(
+        now - trans->attempt_started(),
+        trans->doomed_at() != 0 ? now - trans->doomed_at() : 0);
+  }
+  contention_->AfterAttempt(trans->attempt(), comitted);
+  return comitted;
+}
+
+bool STM::CommitAndAbortConflicts(Transaction* trans) {
   // thread might be blocked here so we need to allow GC to proceed
-  trans->UnlockGC();
+  EnterSafeRegion(trans);
   ScopedLock commit_lock(commit_mutex_);
   ScopedLock transactions_lock(transactions_mutex_);
-  trans->LockGC();
+  LeaveSafeRegion(trans);
 
   bool comitted = false;
 
   // if the transaction was aborted then clear exceptions flag
   // so that it is not transferred to next attempt
-  if (trans->IsAborted()) {
+  if (trans->IsAborted() || !trans->PrepareCommit() ||
+      (versions_ != NULL && !trans->LockRecords(versions_))) {
     trans->ClearExceptions();
   } else {
     // lock all transactions
@@ -628,34 +2320,140 @@ bool STM::CommitTransaction() {
       transactions_[i]->Lock();
     }
 
-    // intersect write set with other transactions
-    // abort those in conflict
-    for (int i = 0; i < transactions_.length(); i++) {
+    // contention manager may protect conflicting transaction, then we
+    // abort ourselves instead
+    bool yield = false;
+    for (int i = 0; i < transactions_.length() && !yield; i++) {
       Transaction* t = transactions_[i];
-      if (t == trans) {
+      if (t == trans || t->IsAborted() ||
+          contention_->MayAbort(trans->priority(), t->priority())) {
         continue;
       }
-      if (t->HasConflicts(trans)) {
-        t->Abort();
-      }
+      yield = t->HasConflicts(trans, false);
     }
 
-    // copy write set back to the heap
-    trans->CommitHeap();
+    if (yield) {
+      if (versions_ != NULL) {
+        trans->RestoreRecords();
+      }
+      trans->Abort();
+      trans->ClearExceptions();
+    } else {
+      // intersect write set with other transactions
+      // abort those in conflict
+      for (int i = 0; i < transactions_.length(); i++) {
+        Transaction* t = transactions_[i];
+        if (t == trans) {
+          continue;
+        }
+        if (t->HasConflicts(trans)) {
+          t->Doom();
+        }
+      }
+
+      // copy write set back to the heap
+      if (versions_ != NULL) {
+        trans->CommitHeapVersioned(snapshots_, &version_clock_);
+      } else {
+        trans->CommitHeap();
+      }
+      comitted = true;
+    }
 
     // unlock all transactions
     for (int i = 0; i < transactions_.length(); i++) {
       transactions_[i]->Unlock();
     }
+  }
+
+  FinishTransaction(trans);
+  return comitted;
+}
+
+bool STM::CommitReadOnly(Transaction* trans) {
+  // validation doesn't allocate, transaction stays running
+  bool comitted = trans->ValidateReadOnly();
+
+  EnterSafeRegion(trans);
+  ScopedLock transactions_lock(transactions_mutex_);
+  LeaveSafeRegion(trans);
+
+  // classic committers abort others while holding `transactions_mutex_`
+  comitted = comitted && !trans->IsAborted();
+  if (comitted) {
+    trans->ApplyAccumulators();
+  } else {
+    trans->ClearExceptions();
+  }
+
+  FinishTransaction(trans);
+  return comitted;
+}
+
+bool STM::CommitVersioned(Transaction* trans) {
+  // transaction stays running because validation and write back neither
+  // allocate nor wait for other transactions
+  bool comitted = !trans->IsAborted() &&
+                  trans->CommitVersioned(&version_clock_, snapshots_);
+
+  if (!comitted) {
+    trans->ClearExceptions();
+  }
+
+  EnterSafeRegion(trans);
+  ScopedLock transactions_lock(transactions_mutex_);
+  LeaveSafeRegion(trans);
+
+  FinishTransaction(trans);
+  return comitted;
+}
+
+ContentionManager* STM::GetContentionManager() {
+  if (contention_ == NULL) {
+    ScopedLock transactions_lock(transactions_mutex_);
+    if (contention_ == NULL) {
+      ContentionManager* contention =
+          ContentionManager::New(FLAG_stm_contention);
+      if (contention == NULL) {
+        FATAL("Unknown contention policy");
+      }
+      contention_ = contention;
+    }
+  }
+  return contention_;
+}
 
-    comitted = true;
+void STM::PrintStatistics() {
+  GetContentionManager()->PrintStatistics();
+
+  // time to safepoint bounds how long GC waits before it can start
+  for (int i = 0; i < MAX_THREADS; i++) {
+    SafepointStatistics* stats = &safepoint_stats_[i];
+    if (stats->count == 0) {
+      continue;
+    }
+    printf("thread %d reached %d safepoints, "
+           "latency %d us average %d us max\n",
+           i, stats->count,
+           static_cast<int>(stats->total_latency / stats->count),
+           static_cast<int>(stats->max_latency));
   }
+}
+
+void STM::DeleteTransaction(Transaction* trans) {
+  delete trans;
+}
 
+// must be called with `transactions_mutex_` acquired
+void STM::FinishTransaction(Transaction* trans) {
   isolate_->set_transaction(NULL);
 
-  ASSERT(transactions_.RemoveElement(trans));
-  delete trans;
-  return comitted;
+  bool removed = transactions_.RemoveElement(trans);
+  ASSERT(removed);
+  USE(removed);
+
+  trans->Reset();
+  isolate_->set_idle_transaction(trans);
 }
 
 } } // namespace v8::internal
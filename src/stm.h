@@ -6,37 +6,155 @@
 namespace v8 {
 namespace internal {
 
+class ContentionManager;
+class SnapshotTable;
 class Transaction;
+class VersionTable;
+
+// commutative value shared by events (script built-in Accumulator)
+// - transaction logs its updates and applies them when it commits, so
+//   accumulators never enter read or write set and never cause conflicts
+// - value seen by transaction is the committed value with its own updates
+//   applied, it is not validated at commit
+class Accumulator {
+ public:
+  enum Operation { kAdd, kMax, kMin };
+
+  explicit Accumulator(double value);
+  ~Accumulator();
+
+  double value();
+  void Update(Operation op, double operand);
+
+  static double Apply(Operation op, double value, double operand);
+
+ private:
+  Mutex* mutex_;
+  double value_;
+
+  DISALLOW_COPY_AND_ASSIGN(Accumulator);
+};
+
+// work that GC thread shares with threads paused for GC (see
+// STM::RunGCTask), Run is called once in each of them
+class GCTask {
+ public:
+  virtual ~GCTask() {}
+  virtual void Run() = 0;
+};
 
 class STM {
  public:
   void EnterAllocationScope();
   void LeaveAllocationScope();
+  // thread continues allocating new space from another buffer (see
+  // Heap::AllocateRawLocal), start is NULL when it has none
+  void SwitchAllocationBuffer(Address top, Address start);
 
   bool EnterCollectionScope();
   void LeaveCollectionScope();
 
+  // in collection scope only, helpers are threads paused for GC (threads
+  // blocked in commit don't help)
+  int GCHelpers();
+  // returns when task finished in the current thread and in all helpers
+  void RunGCTask(GCTask* task);
+
+  // safepoint of the current thread, called before allocation and on
+  // interrupt requested by GC (see StackGuard::RequestSTMSafepoint)
+  void PauseForGC();
+
   void Iterate(ObjectVisitor* v);
 
   Handle<Object> RedirectLoad(Handle<Object> obj, bool* terminate);
   Handle<Object> RedirectStore(Handle<Object> obj, bool* terminate);
 
-  void StartTransaction();
+  // access to a single property (key is name or element index)
+  Handle<Object> RedirectLoad(Handle<Object> obj, Handle<Object> key,
+                              bool* terminate);
+  Handle<Object> RedirectStore(Handle<Object> obj, Handle<Object> key,
+                               bool* terminate);
+
+  // attempt is 0 for the first attempt of an event and is incremented with
+  // each retry after abort (contention manager decides when it starts)
+  // read-only transaction doesn't build read set, it validates against
+  // version records at commit (it is restarted as read-write if it writes)
+  void StartTransaction(int attempt = 0, bool read_only = false);
   bool CommitTransaction();
 
+  // whether transaction of the current thread was aborted
+  bool IsDoomed();
+
+  // barriers called by field load and store IC stubs (without exit frame,
+  // they neither allocate nor throw)
+  // - slot is the field index, stores adding a property pass kTransitionSlot
+  // - result is the object to access or NULL if the access must go through
+  //   IC miss (e.g. the object needs a copy)
+  static const int kTransitionSlot = -1;
+  static Object* LoadBarrier(Isolate* isolate, Object* obj, int slot);
+  static Object* StoreBarrier(Isolate* isolate, Object* obj, int slot);
+
+  // holder is the script object of accumulator, it is kept alive by
+  // transaction until the update is applied
+  void Accumulate(Handle<Object> holder, Accumulator* accumulator,
+                  Accumulator::Operation op, double operand);
+  double AccumulatorValue(Accumulator* accumulator);
+
+  void PrintStatistics();
+
+  // frees the transaction that a thread keeps for its next event (see
+  // FinishTransaction) when thread data is torn down
+  static void DeleteTransaction(Transaction* trans);
+
  private:
   DISALLOW_IMPLICIT_CONSTRUCTORS(STM);
 
-  void PauseForGC();
+  // transaction may block outside the heap (e.g. on a commit mutex) only in
+  // safe region, GC doesn't wait for it then
+  void EnterSafeRegion(Transaction* trans);
+  void LeaveSafeRegion(Transaction* trans);
+  void ReleaseHeld(Transaction* trans);
+
+  void RecordSafepoint(Transaction* trans, int64_t latency);
+
+  ContentionManager* GetContentionManager();
+
+  bool CommitAndAbortConflicts(Transaction* trans);
+  bool CommitReadOnly(Transaction* trans);
+  bool CommitVersioned(Transaction* trans);
+  void FinishTransaction(Transaction* trans);
 
   volatile Atomic32 need_gc_;
 
+  // global version clock and object version records (--stm-version-clock
+  // and read-only transactions)
+  volatile Atomic32 version_clock_;
+  VersionTable* versions_;
+
+  // previous versions of objects for snapshot readers (--stm-mvcc)
+  SnapshotTable* snapshots_;
+
+  // created on first use because flags are parsed after the isolate
+  ContentionManager* contention_;
+  volatile Atomic32 next_priority_;
+
   // commit_mutex_ must be acquired before transactions_mutex_
-  // heap_mutex_ is independent from them
-  Mutex* heap_mutex_;
   Mutex* commit_mutex_;
   Mutex* transactions_mutex_;
 
+  // signalled by threads that stopped running while GC was requested
+  Semaphore* safepoint_reached_;
+
+  // counts helpers that finished a task or refreshed their sets after GC
+  Semaphore* gc_helpers_done_;
+
+  struct SafepointStatistics {
+    int count;
+    int64_t total_latency;
+    int64_t max_latency;
+  };
+  SafepointStatistics safepoint_stats_[MAX_THREADS];
+
   List<Transaction*> transactions_;
 
   Isolate* isolate_;
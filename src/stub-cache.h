@@ -471,6 +471,16 @@ class StubCompiler BASE_EMBEDDED {
                                  Register scratch,
                                  Label* miss_label);
 
+  // Replaces the object in the register with the object the current STM
+  // transaction works with (its copy) before a field is accessed. Jumps to
+  // miss_label with all registers preserved if the runtime must redirect
+  // the object. Emits nothing unless --stm is on.
+  static void GenerateSTMBarrier(MacroAssembler* masm,
+                                 Register object,
+                                 int slot,
+                                 bool is_store,
+                                 Label* miss_label);
+
   static void GenerateLoadMiss(MacroAssembler* masm,
                                Code::Kind kind);
 
@@ -85,6 +85,7 @@
         'test-serialize.cc',
         'test-sockets.cc',
         'test-spaces.cc',
+        'test-stm.cc',
         'test-strings.cc',
         'test-strtod.cc',
         'test-thread-termination.cc',
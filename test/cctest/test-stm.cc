@@ -0,0 +1,480 @@
+#include <stdlib.h>
+
+#include <map>
+#include <set>
+
+#include "v8.h"
+#include "platform.h"
+#include "stm-index.h"
+#include "cctest.h"
+
+using namespace v8::internal;
+
+// fake object addresses, tagged and spread like objects in a heap page
+static Object* FakeObject(int i) {
+  uintptr_t address = 0x10000000 + static_cast<uintptr_t>(i) * 3 * kPointerSize;
+  return reinterpret_cast<Object*>(address + kHeapObjectTag);
+}
+
+
+static void FillCells(CellPair* cells, int count) {
+  for (int i = 0; i < count; i++) {
+    cells[i].from_ = FakeObject(i);
+    cells[i].to_ = cells[i].from_;
+    cells[i].state_ = 0;
+    cells[i].first_slot_ = -1;
+  }
+}
+
+
+TEST(CellIndexLookup) {
+  const int kCount = 1000;
+  CellPair* cells = NewArray<CellPair>(kCount);
+  FillCells(cells, kCount);
+
+  CellIndex objects(CellIndex::kByObject);
+  CellIndex locations(CellIndex::kByLocation);
+  for (int i = 0; i < kCount; i++) {
+    objects.Insert(&cells[i]);
+    locations.Insert(&cells[i]);
+  }
+  CHECK_EQ(kCount, static_cast<int>(objects.occupancy()));
+
+  for (int i = 0; i < kCount; i++) {
+    CHECK_EQ(&cells[i], objects.Lookup(cells[i].from_));
+    CHECK_EQ(&cells[i], locations.Lookup(&cells[i].to_));
+  }
+  CHECK_EQ(NULL, objects.Lookup(FakeObject(kCount)));
+  CHECK_EQ(NULL, locations.Lookup(&cells[0].from_));
+
+  // storage is kept for the next transaction
+  int capacity = objects.capacity();
+  objects.Clear();
+  CHECK_EQ(0, static_cast<int>(objects.occupancy()));
+  CHECK_EQ(capacity, static_cast<int>(objects.capacity()));
+  CHECK_EQ(NULL, objects.Lookup(cells[0].from_));
+
+  DeleteArray(cells);
+}
+
+
+TEST(CellIndexRehash) {
+  const int kCount = 1000;
+  CellPair* cells = NewArray<CellPair>(kCount);
+  FillCells(cells, kCount);
+
+  CellIndex objects(CellIndex::kByObject);
+  for (int i = 0; i < kCount; i++) {
+    objects.Insert(&cells[i]);
+  }
+
+  // simulate GC moving every other object
+  for (int i = 0; i < kCount; i += 2) {
+    cells[i].from_ = FakeObject(i + 7 * kCount);
+  }
+  objects.Rehash();
+
+  for (int i = 0; i < kCount; i++) {
+    CHECK_EQ(&cells[i], objects.Lookup(cells[i].from_));
+  }
+  for (int i = 0; i < kCount; i += 2) {
+    CHECK_EQ(NULL, objects.Lookup(FakeObject(i)));
+  }
+  CHECK_EQ(kCount, static_cast<int>(objects.occupancy()));
+
+  DeleteArray(cells);
+}
+
+
+TEST(CellSignature) {
+  const int kCount = 100;
+  CellSignature even;
+  CellSignature odd;
+  CellSignature other;
+  for (int i = 0; i < kCount; i++) {
+    if (i % 2 == 0) even.Add(FakeObject(i)); else odd.Add(FakeObject(i));
+  }
+  other.Add(FakeObject(kCount + 1));
+  other.Add(FakeObject(kCount + 2));
+
+  // no false negatives
+  for (int i = 0; i < kCount; i += 2) {
+    CellSignature single;
+    single.Add(FakeObject(i));
+    CHECK(even.MayIntersect(single));
+    CHECK(single.MayIntersect(even));
+  }
+
+  // small disjoint sets are ruled out
+  CHECK(!even.MayIntersect(other));
+  CHECK(!odd.MayIntersect(other));
+
+  other.Clear();
+  CHECK(!even.MayIntersect(other));
+}
+
+
+TEST(CellSignatureGrowth) {
+  const int kCount = 10000;
+  CellSignature large;
+  for (int i = 0; i < kCount; i++) {
+    large.Add(FakeObject(i));
+    if (large.IsCrowded()) {
+      // owner adds the keys again (see CellMap::RebuildSignature)
+      large.Reset(large.count());
+      for (int j = 0; j <= i; j++) large.Add(FakeObject(j));
+    }
+  }
+  CHECK(!large.IsCrowded());
+  CHECK_EQ(kCount, large.count());
+  CHECK_GE(large.size(), 16 * kCount);
+
+  // no false negatives
+  for (int i = 0; i < kCount; i++) {
+    CHECK(large.Contains(FakeObject(i)));
+  }
+
+  // keys of a small disjoint set are mostly ruled out
+  int false_positives = 0;
+  for (int i = kCount; i < 2 * kCount; i++) {
+    if (large.Contains(FakeObject(i))) false_positives++;
+  }
+  CHECK_LT(false_positives, kCount / 16);
+
+  // storage is kept but the signature is small again
+  CellSignature small;
+  large.Clear();
+  CHECK(large.SameSize(small));
+  CHECK(!large.MayIntersect(small));
+}
+
+
+TEST(SlotSet) {
+  const int kCount = 100;
+  const int kSlots = 10;
+  CellPair* cells = NewArray<CellPair>(kCount);
+  FillCells(cells, kCount);
+
+  SlotSet slots;
+  for (int i = 0; i < kCount; i++) {
+    for (int slot = -kSlots; slot < kSlots; slot += 2) {
+      slots.FindOrAdd(&cells[i], slot)->mode_ |= 1;
+    }
+  }
+  CHECK_EQ(kCount * kSlots, slots.length());
+
+  // existing entries are found, not added again
+  CHECK_EQ(slots.Find(&cells[3], 4), slots.FindOrAdd(&cells[3], 4));
+  CHECK_EQ(1, slots.Find(&cells[3], 4)->mode_);
+  CHECK_EQ(NULL, slots.Find(&cells[3], 5));
+  CHECK_EQ(kCount * kSlots, slots.length());
+
+  // each cell lists exactly its own slots
+  for (int i = 0; i < kCount; i++) {
+    int count = 0;
+    for (SlotEntry* entry = slots.First(&cells[i]);
+         entry != NULL;
+         entry = slots.Next(entry)) {
+      CHECK_EQ(&cells[i], entry->cell_);
+      CHECK_EQ(0, (entry->slot_ + kSlots) % 2);
+      count++;
+    }
+    CHECK_EQ(kSlots, count);
+  }
+
+  slots.Clear();
+  CHECK_EQ(0, slots.length());
+  CHECK_EQ(NULL, slots.Find(&cells[3], 4));
+
+  DeleteArray(cells);
+}
+
+
+// runs a store in a transaction that commits after the main thread's one
+class StoringThread : public Thread {
+ public:
+  StoringThread(v8::Handle<v8::Context> context, const char* source)
+      : Thread("StoringThread"),
+        isolate_(v8::Isolate::GetCurrent()),
+        context_(v8::Persistent<v8::Context>::New(context)),
+        source_(source),
+        stored_(OS::CreateSemaphore(0)),
+        may_commit_(OS::CreateSemaphore(0)),
+        committed_(false) {
+  }
+
+  ~StoringThread() {
+    context_.Dispose();
+    delete stored_;
+    delete may_commit_;
+  }
+
+  virtual void Run() {
+    v8::Isolate::Scope isolate_scope(isolate_);
+    v8::HandleScope handle_scope;
+    v8::Context::Scope context_scope(context_);
+    STM* stm = Isolate::Current()->stm();
+
+    stm->StartTransaction();
+    CompileRun(source_);
+    stored_->Signal();
+    may_commit_->Wait();
+    committed_ = stm->CommitTransaction();
+  }
+
+  Semaphore* stored() { return stored_; }
+  Semaphore* may_commit() { return may_commit_; }
+  bool committed() { return committed_; }
+
+ private:
+  v8::Isolate* isolate_;
+  v8::Persistent<v8::Context> context_;
+  const char* source_;
+  Semaphore* stored_;
+  Semaphore* may_commit_;
+  bool committed_;
+};
+
+
+// the other thread stores in a transaction that is still running when the
+// main thread commits its store into the same object, returns whether the
+// other transaction committed too and evaluates the result afterwards
+static bool CommitsAfter(const char* source, const char* other_source,
+                         const char* result, int expected) {
+  v8::HandleScope handle_scope;
+  LocalContext context;
+  STM* stm = Isolate::Current()->stm();
+
+  stm->StartTransaction();
+  CompileRun("var o = { a: 0, b: 0 };");
+  CHECK(stm->CommitTransaction());
+
+  StoringThread thread(context.local(), other_source);
+  thread.Start();
+  thread.stored()->Wait();
+
+  stm->StartTransaction();
+  CompileRun(source);
+  CHECK(stm->CommitTransaction());
+
+  thread.may_commit()->Signal();
+  thread.Join();
+
+  stm->StartTransaction();
+  CHECK_EQ(expected, CompileRun(result)->Int32Value());
+  CHECK(stm->CommitTransaction());
+  return thread.committed();
+}
+
+
+TEST(DisjointFieldStores) {
+  if (!FLAG_stm) return;
+
+  // slots of the same object are tracked separately
+  CHECK(CommitsAfter("o.a = 1;", "o.b = 2;", "o.a * 10 + o.b", 12));
+
+  // store into the same slot still conflicts
+  CHECK(!CommitsAfter("o.a = 1;", "o.a = 2;", "o.a * 10 + o.b", 10));
+}
+
+
+// allocates garbage in a transaction, it is paused for GCs of the main
+// thread and helps with them
+class AllocatingThread : public Thread {
+ public:
+  explicit AllocatingThread(v8::Handle<v8::Context> context)
+      : Thread("AllocatingThread"),
+        isolate_(v8::Isolate::GetCurrent()),
+        context_(v8::Persistent<v8::Context>::New(context)),
+        started_(OS::CreateSemaphore(0)) {
+  }
+
+  ~AllocatingThread() {
+    context_.Dispose();
+    delete started_;
+  }
+
+  virtual void Run() {
+    v8::Isolate::Scope isolate_scope(isolate_);
+    v8::HandleScope handle_scope;
+    v8::Context::Scope context_scope(context_);
+    STM* stm = Isolate::Current()->stm();
+
+    stm->StartTransaction();
+    started_->Signal();
+    CompileRun("(function () {"
+               "  var garbage = null;"
+               "  for (var i = 0; i < 1000000; i++) {"
+               "    garbage = (i % 1000 == 0) ? null : [garbage, i];"
+               "  }"
+               "})();");
+    stm->CommitTransaction();
+  }
+
+  Semaphore* started() { return started_; }
+
+ private:
+  v8::Isolate* isolate_;
+  v8::Persistent<v8::Context> context_;
+  Semaphore* started_;
+};
+
+
+TEST(ParallelScavenge) {
+  if (!FLAG_stm) return;
+
+  v8::HandleScope handle_scope;
+  LocalContext context;
+  STM* stm = Isolate::Current()->stm();
+
+  // values and lengths of names of a list of 10000 elements
+  int expected = 0;
+  for (int i = 0; i < 10000; i++) {
+    int digits = 1;
+    for (int n = i; n >= 10; n /= 10) digits++;
+    expected += i + 1 + digits;
+  }
+
+  AllocatingThread thread(context.local());
+  thread.Start();
+  thread.started()->Wait();
+
+  stm->StartTransaction();
+  CompileRun("function List(n) {"
+             "  var list = null;"
+             "  for (var i = 0; i < n; i++) {"
+             "    list = { value: i, name: 'x' + i, next: list };"
+             "  }"
+             "  return list;"
+             "}"
+             "function Sum(list) {"
+             "  var sum = 0;"
+             "  for (; list != null; list = list.next) {"
+             "    sum += list.value + list.name.length;"
+             "  }"
+             "  return sum;"
+             "}");
+  for (int round = 0; round < 10; round++) {
+    CompileRun("var list = List(10000);");
+    HEAP->CollectGarbage(NEW_SPACE);
+    CHECK_EQ(expected, CompileRun("Sum(list)")->Int32Value());
+  }
+  CHECK(stm->CommitTransaction());
+
+  thread.Join();
+}
+
+
+// previous implementation of CellMap lookups, kept for comparison
+class StdCellMap {
+ public:
+  void Insert(CellPair* pair) {
+    location_set_.insert(&pair->to_);
+    object_map_.insert(ObjectMap::value_type(pair->from_, &pair->to_));
+  }
+
+  bool IsMapped(Object** location) {
+    return location_set_.find(location) != location_set_.end();
+  }
+
+  Object** GetMapping(Object* object) {
+    ObjectMap::const_iterator it = object_map_.find(object);
+    return it != object_map_.end() ? it->second : NULL;
+  }
+
+  void Rebuild(CellPair* cells, int count) {
+    object_map_.clear();
+    for (int i = 0; i < count; i++) {
+      object_map_.insert(ObjectMap::value_type(cells[i].from_, &cells[i].to_));
+    }
+  }
+
+ private:
+  typedef std::set<Object**> LocationSet;
+  typedef std::map<Object*, Object**> ObjectMap;
+
+  LocationSet location_set_;
+  ObjectMap object_map_;
+};
+
+
+// models a transaction with a read set of given size: build the set, look
+// every object up several times (as RedirectLoad does), survive one GC
+static void BenchmarkReadSet(int count) {
+  const int kLookupRounds = 4;
+  CellPair* cells = NewArray<CellPair>(count);
+  int found = 0;
+
+  FillCells(cells, count);
+  int64_t start = OS::Ticks();
+  {
+    StdCellMap map;
+    for (int i = 0; i < count; i++) {
+      map.Insert(&cells[i]);
+    }
+    for (int round = 0; round < kLookupRounds; round++) {
+      for (int i = 0; i < count; i++) {
+        if (map.IsMapped(&cells[i].to_) &&
+            map.GetMapping(cells[i].from_) != NULL) {
+          found++;
+        }
+      }
+    }
+    for (int i = 0; i < count; i++) {
+      cells[i].from_ = FakeObject(i + count);
+    }
+    map.Rebuild(cells, count);
+    for (int i = 0; i < count; i++) {
+      if (map.GetMapping(cells[i].from_) != NULL) found++;
+    }
+  }
+  int64_t std_time = OS::Ticks() - start;
+  CHECK_EQ((kLookupRounds + 1) * count, found);
+
+  found = 0;
+  FillCells(cells, count);
+  start = OS::Ticks();
+  {
+    CellIndex objects(CellIndex::kByObject);
+    CellIndex locations(CellIndex::kByLocation);
+    for (int i = 0; i < count; i++) {
+      objects.Insert(&cells[i]);
+      locations.Insert(&cells[i]);
+    }
+    for (int round = 0; round < kLookupRounds; round++) {
+      for (int i = 0; i < count; i++) {
+        if (locations.Lookup(&cells[i].to_) != NULL &&
+            objects.Lookup(cells[i].from_) != NULL) {
+          found++;
+        }
+      }
+    }
+    for (int i = 0; i < count; i++) {
+      cells[i].from_ = FakeObject(i + count);
+    }
+    objects.Rehash();
+    for (int i = 0; i < count; i++) {
+      if (objects.Lookup(cells[i].from_) != NULL) found++;
+    }
+  }
+  int64_t index_time = OS::Ticks() - start;
+  CHECK_EQ((kLookupRounds + 1) * count, found);
+
+  if (FLAG_testing_benchmarks) {
+    printf("read set of %d entries: std::map %d us, CellIndex %d us\n",
+           count, static_cast<int>(std_time), static_cast<int>(index_time));
+  }
+
+  DeleteArray(cells);
+}
+
+
+// only checks the lookups by default, run with --testing-benchmarks to
+// get the timings and the larger read set
+TEST(CellIndexBenchmark) {
+  BenchmarkReadSet(1000);
+  if (FLAG_testing_benchmarks) {
+    BenchmarkReadSet(10000);
+    BenchmarkReadSet(100000);
+  }
+}
@@ -435,6 +435,9 @@
             '../../src/spaces.h',
             '../../src/stm.cc',
             '../../src/stm.h',
+            '../../src/stm-index.h',
+            '../../src/stm-contention.cc',
+            '../../src/stm-contention.h',
             '../../src/store-buffer-inl.h',
             '../../src/store-buffer.cc',
             '../../src/store-buffer.h',
@@ -1,8 +1,9 @@
 // we include internal header which includes the public one
 #include <v8.h>
+#include <api.h>
+#include <stm-contention.h>
 
 // standard library
-#include <queue>
 #include <string>
 #include <fstream>
 
@@ -50,11 +51,18 @@ Handle<Value> Print(const Arguments& args)
   return Undefined();
 }
 
+struct EventLane;
+
 // each Event incapsulates a JavaScript closure
+// - keyed events belong to a lane, Next links events waiting in the lane
 struct Event {
   Persistent<Function> Func;
+  bool ReadOnly;
+  EventLane* Lane;
+  Event* Next;
 
-  Event(Handle<Function> func) {
+  Event(Handle<Function> func, bool read_only, EventLane* lane = NULL)
+    : ReadOnly(read_only), Lane(lane), Next(NULL) {
     Func = Persistent<Function>::New(func);
   }
 
@@ -67,77 +75,833 @@ struct Event {
   }
 };
 
-std::queue<Event*> event_queue;
+// lock-free work-stealing deque of events (Chase-Lev)
+// - the owning worker pushes and pops at the bottom, so events spawned by an
+//   event run next on the same thread while their data is in its cache
+// - idle workers steal the oldest events from the top
+// - only the owner grows the array, replaced arrays are kept until the deque
+//   is deleted because a thief may still be reading them
+class EventDeque {
+ public:
+  EventDeque() : top_(0), bottom_(0) {
+    array_ = reinterpret_cast<v8::internal::AtomicWord>(
+      new EventArray(kInitialSize, NULL));
+  }
+
+  ~EventDeque() {
+    EventArray* array = Array();
+    while (array != NULL) {
+      EventArray* previous = array->previous;
+      delete array;
+      array = previous;
+    }
+  }
+
+  // owner only
+  void Push(Event* e) {
+    v8::internal::AtomicWord b = v8::internal::NoBarrier_Load(&bottom_);
+    v8::internal::AtomicWord t = v8::internal::Acquire_Load(&top_);
+    EventArray* array = Array();
+    if (b - t >= array->size) {
+      array = array->Grow(t, b);
+      v8::internal::Release_Store(
+        &array_, reinterpret_cast<v8::internal::AtomicWord>(array));
+    }
+    array->Put(b, e);
+    v8::internal::Release_Store(&bottom_, b + 1);
+  }
+
+  // owner only, returns NULL when empty
+  Event* Pop() {
+    v8::internal::AtomicWord b = v8::internal::NoBarrier_Load(&bottom_) - 1;
+    EventArray* array = Array();
+    v8::internal::NoBarrier_Store(&bottom_, b);
+    v8::internal::MemoryBarrier();
+    v8::internal::AtomicWord t = v8::internal::NoBarrier_Load(&top_);
+    if (t > b) {
+      v8::internal::NoBarrier_Store(&bottom_, b + 1);
+      return NULL;
+    }
+
+    Event* e = array->Get(b);
+    if (t == b) {
+      // the last event, thieves may be taking it too
+      if (v8::internal::NoBarrier_CompareAndSwap(&top_, t, t + 1) != t) {
+        e = NULL;
+      }
+      v8::internal::NoBarrier_Store(&bottom_, b + 1);
+    }
+    return e;
+  }
+
+  // any thread, returns NULL when empty or when other thread took the event
+  Event* Steal() {
+    v8::internal::AtomicWord t = v8::internal::Acquire_Load(&top_);
+    v8::internal::MemoryBarrier();
+    v8::internal::AtomicWord b = v8::internal::Acquire_Load(&bottom_);
+    if (t >= b) {
+      return NULL;
+    }
+
+    Event* e = Array()->Get(t);
+    if (v8::internal::NoBarrier_CompareAndSwap(&top_, t, t + 1) != t) {
+      return NULL;
+    }
+    return e;
+  }
+
+  bool IsEmpty() {
+    return v8::internal::Acquire_Load(&top_) >=
+           v8::internal::Acquire_Load(&bottom_);
+  }
+
+ private:
+  static const int kInitialSize = 256;
+
+  struct EventArray {
+    EventArray(v8::internal::AtomicWord size, EventArray* previous)
+      : size(size), events(new Event*[size]), previous(previous) {
+    }
+
+    ~EventArray() {
+      delete[] events;
+    }
+
+    Event* Get(v8::internal::AtomicWord i) {
+      return events[i & (size - 1)];
+    }
+
+    void Put(v8::internal::AtomicWord i, Event* e) {
+      events[i & (size - 1)] = e;
+    }
+
+    EventArray* Grow(v8::internal::AtomicWord top,
+                     v8::internal::AtomicWord bottom) {
+      EventArray* array = new EventArray(2 * size, this);
+      for (v8::internal::AtomicWord i = top; i < bottom; i++) {
+        array->Put(i, Get(i));
+      }
+      return array;
+    }
+
+    v8::internal::AtomicWord size;
+    Event** events;
+    EventArray* previous;
+  };
+
+  EventArray* Array() {
+    return reinterpret_cast<EventArray*>(
+      v8::internal::Acquire_Load(&array_));
+  }
+
+  volatile v8::internal::AtomicWord top_;
+  volatile v8::internal::AtomicWord bottom_;
+  volatile v8::internal::AtomicWord array_;
+};
+
+// deque of each worker, worker pushes events spawned by its events to its
+// own deque (the deque of the current thread is in thread local storage)
+EventDeque* event_deques[v8::internal::MAX_THREADS];
+int event_deques_count = 0;
+v8::internal::Thread::LocalStorageKey event_deque_key =
+  v8::internal::Thread::CreateThreadLocalKey();
+
+// workers which may push events: those running an event or looking for one
+// (idle workers count themselves in before each attempt to steal)
+// - worker counts itself out only when its own deque is empty and only the
+//   owner pushes to a deque, so when the count drops to zero all deques are
+//   empty and no event can be pushed any more, the worker which brings it
+//   to zero finishes the loops
+// - all workers are counted in from the start (main thread pushes events
+//   of the initial script)
 v8::internal::Atomic32 running_threads = 0;
+v8::internal::Atomic32 finished = 0;
+
+// idle workers spin for a while and then park on the semaphore (futex on
+// Linux), async wakes one of them up when any is parked
+// - parked_workers counts workers parked or about to park, a worker that
+//   finds work before parking takes itself out if nobody woke it yet
+v8::internal::Atomic32 parked_workers = 0;
+v8::internal::Semaphore* parked_semaphore =
+  v8::internal::OS::CreateSemaphore(0);
+
+// events run in one transaction at most (see AdjustBatchLimit)
+const int kMaxBatch = 64;
+
+// events are counted when their transaction commits, attempts that abort
+// are counted in aborted_transactions only
+v8::internal::Atomic32 total_events = 0;
 v8::internal::Atomic32 total_transactions = 0;
 v8::internal::Atomic32 aborted_transactions = 0;
-v8::internal::Mutex* mutex = v8::internal::OS::CreateMutex();
 
-// JavaScript function async(function())
-Handle<Value> Async(const Arguments& args) {
-  v8::internal::ScopedLock mutex_lock(mutex);
+// workers with index below active_workers run events, the others finish
+// events of their own deques and then park on their own semaphore until the
+// controller lets them run again (see ConcurrencyController)
+v8::internal::Atomic32 active_workers = 0;
+v8::internal::Atomic32 throttled_workers = 0;
+v8::internal::Semaphore* throttled_semaphore =
+  v8::internal::OS::CreateSemaphore(0);
+
+// takes one worker out of parked (or throttled) workers, returns false if
+// there is none
+bool ClaimParkedWorker(v8::internal::Atomic32* workers) {
+  while (true) {
+    v8::internal::Atomic32 parked = v8::internal::Acquire_Load(workers);
+    if (parked == 0) {
+      return false;
+    }
+    if (v8::internal::NoBarrier_CompareAndSwap(
+            workers, parked, parked - 1) == parked) {
+      return true;
+    }
+  }
+}
 
+void WakeParkedWorker() {
+  if (ClaimParkedWorker(&parked_workers)) {
+    parked_semaphore->Signal();
+  }
+}
+
+void WakeThrottledWorkers() {
+  // each of them checks whether it may run now
+  while (ClaimParkedWorker(&throttled_workers)) {
+    throttled_semaphore->Signal();
+  }
+}
+
+bool IsThrottled(int index) {
+  return index >= v8::internal::Acquire_Load(&active_workers);
+}
+
+// serial lane of keyed events, at most one event of a lane is in a deque or
+// running, the others wait in the lane in the order they were pushed
+// - keys are hashed onto lanes, so events with equal keys run one after
+//   another (and never abort each other) while different keys mostly run
+//   in parallel
+// - event released from the lane goes to the deque of the worker which ran
+//   its predecessor, where the data of the key probably is in cache
+struct EventLane {
+  v8::internal::Mutex* mutex;
+  Event* first;
+  Event* last;
+  bool busy;
+
+  EventLane()
+    : mutex(v8::internal::OS::CreateMutex()),
+      first(NULL), last(NULL), busy(false) {
+  }
+
+  // returns true if the event may run now, queues it otherwise
+  bool Enqueue(Event* e) {
+    v8::internal::ScopedLock lock(mutex);
+    if (!busy) {
+      busy = true;
+      return true;
+    }
+    if (last == NULL) {
+      first = e;
+    } else {
+      last->Next = e;
+    }
+    last = e;
+    return false;
+  }
+
+  // called when an event of the lane finished, returns the next one
+  Event* Dequeue() {
+    v8::internal::ScopedLock lock(mutex);
+    Event* e = first;
+    if (e == NULL) {
+      busy = false;
+      return NULL;
+    }
+    first = e->Next;
+    if (first == NULL) {
+      last = NULL;
+    }
+    e->Next = NULL;
+    return e;
+  }
+};
+
+const int kEventLanes = 256;
+EventLane event_lanes[kEventLanes];
+
+EventLane* LaneOf(const char* key, int length) {
+  uint32_t hash = 0;
+  for (int i = 0; i < length; i++) {
+    hash = 31 * hash + static_cast<uint8_t>(key[i]);
+  }
+  return &event_lanes[v8::internal::ComputeIntegerHash(hash) % kEventLanes];
+}
+
+void ScheduleEvent(Event* e) {
+  EventDeque* deque = reinterpret_cast<EventDeque*>(
+    v8::internal::Thread::GetExistingThreadLocal(event_deque_key));
+  ASSERT(deque != NULL);
+  deque->Push(e);
+
+  // parked worker either sees the event or is counted here
+  v8::internal::MemoryBarrier();
+  if (v8::internal::NoBarrier_Load(&parked_workers) > 0) {
+    WakeParkedWorker();
+  }
+}
+
+// events spawned by the transaction a worker is running, they are scheduled
+// only when it commits and deleted when it aborts (the restarted attempt
+// spawns them again), so events of aborted attempts never run
+// - events are linked through Next, keyed events enter their lane only when
+//   they are scheduled
+class SpawnedEvents {
+ public:
+  SpawnedEvents() : first_(NULL), last_(NULL) {
+  }
+
+  void Add(Event* e) {
+    if (last_ == NULL) {
+      first_ = e;
+    } else {
+      last_->Next = e;
+    }
+    last_ = e;
+  }
+
+  // schedules events in the order they were spawned
+  void Flush() {
+    Event* e = first_;
+    first_ = last_ = NULL;
+    while (e != NULL) {
+      Event* next = e->Next;
+      e->Next = NULL;
+      if (e->Lane == NULL || e->Lane->Enqueue(e)) {
+        ScheduleEvent(e);
+      }
+      e = next;
+    }
+  }
+
+  void Drop() {
+    Event* e = first_;
+    first_ = last_ = NULL;
+    while (e != NULL) {
+      Event* next = e->Next;
+      delete e;
+      e = next;
+    }
+  }
+
+ private:
+  Event* first_;
+  Event* last_;
+};
+
+SpawnedEvents spawned_events[v8::internal::MAX_THREADS];
+v8::internal::Thread::LocalStorageKey spawned_events_key =
+  v8::internal::Thread::CreateThreadLocalKey();
+
+SpawnedEvents* CurrentSpawnedEvents() {
+  SpawnedEvents* spawned = reinterpret_cast<SpawnedEvents*>(
+    v8::internal::Thread::GetExistingThreadLocal(spawned_events_key));
+  ASSERT(spawned != NULL);
+  return spawned;
+}
+
+void PushEvent(const Arguments& args, bool read_only) {
   HandleScope handle_scope;
   Handle<Function> func = Handle<Function>::Cast(args[0]);
+  CurrentSpawnedEvents()->Add(new Event(func, read_only));
+}
+
+void PushKeyedEvent(const Arguments& args) {
+  HandleScope handle_scope;
+  String::Utf8Value key(args[0]);
+  Handle<Function> func = Handle<Function>::Cast(args[1]);
+
+  EventLane* lane = LaneOf(*key, key.length());
+  CurrentSpawnedEvents()->Add(new Event(func, false, lane));
+}
+
+// deletes event which committed, the next event of its lane may run then
+// (it is pushed before the worker can count itself out)
+void FinishEvent(Event* e) {
+  if (e->Lane != NULL) {
+    Event* next = e->Lane->Dequeue();
+    if (next != NULL) {
+      ScheduleEvent(next);
+    }
+  }
+  delete e;
+}
+
+// takes the oldest event of another worker, starting with the next one so
+// that thieves spread over victims
+Event* StealEvent(int index) {
+  for (int i = 1; i < event_deques_count; i++) {
+    Event* e = event_deques[(index + i) % event_deques_count]->Steal();
+    if (e != NULL) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+bool AllDequesEmpty() {
+  for (int i = 0; i < event_deques_count; i++) {
+    if (!event_deques[i]->IsEmpty()) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  Event* e = new Event(func);
-  event_queue.push(e);
+// JavaScript function async(function())
+// the function runs after the calling event commits
+Handle<Value> Async(const Arguments& args) {
+  PushEvent(args, false);
+  return Undefined();
+}
 
+// JavaScript function asyncKeyed(key, function())
+// events with equal keys (compared as strings) run in the order they were
+// pushed and one at a time, so events updating state of the same entity
+// don't conflict
+Handle<Value> AsyncKeyed(const Arguments& args) {
+  PushKeyedEvent(args);
   return Undefined();
 }
 
-void EventLoop(v8::internal::STM* stm) {
-  bool active = true;
-  v8::internal::Barrier_AtomicIncrement(&running_threads, 1);
+// JavaScript function asyncReadOnly(function())
+// the function is expected not to modify shared objects, it runs without
+// read set and commits without global locks (if it writes it is restarted
+// as ordinary event)
+Handle<Value> AsyncReadOnly(const Arguments& args) {
+  PushEvent(args, true);
+  return Undefined();
+}
 
-  // loop until queue is empty and others are idle too
-  while (true) {
-    Event* e = NULL;
-    {
-      v8::internal::ScopedLock mutex_lock(mutex);
-
-      if (active) {
-        // count me out
-        running_threads--;
-        active = false;
+// JavaScript constructor Accumulator(value)
+// shared number whose updates commute (add, max, min), events updating it
+// don't conflict because updates are applied when transaction commits
+v8::internal::Accumulator* UnwrapAccumulator(const Arguments& args) {
+  return static_cast<v8::internal::Accumulator*>(
+    args.Holder()->GetPointerFromInternalField(0));
+}
+
+void DisposeAccumulator(Persistent<Value> object, void* parameter) {
+  delete static_cast<v8::internal::Accumulator*>(parameter);
+  object.Dispose();
+}
+
+Handle<Value> NewAccumulator(const Arguments& args) {
+  if (!args.IsConstructCall()) {
+    return ThrowException(String::New("Accumulator must be called with new"));
+  }
+
+  double value = args.Length() > 0 ? args[0]->NumberValue() : 0;
+  v8::internal::Accumulator* accumulator =
+    new v8::internal::Accumulator(value);
+  args.This()->SetPointerInInternalField(0, accumulator);
+  Persistent<Object>::New(args.This()).MakeWeak(accumulator,
+                                                DisposeAccumulator);
+  return args.This();
+}
+
+Handle<Value> UpdateAccumulator(const Arguments& args,
+                                v8::internal::Accumulator::Operation op) {
+  HandleScope handle_scope;
+  v8::internal::STM* stm = v8::internal::Isolate::Current()->stm();
+  stm->Accumulate(v8::Utils::OpenHandle(*args.Holder()),
+                  UnwrapAccumulator(args), op, args[0]->NumberValue());
+  return Undefined();
+}
+
+// JavaScript method accumulator.add(n)
+Handle<Value> AccumulatorAdd(const Arguments& args) {
+  return UpdateAccumulator(args, v8::internal::Accumulator::kAdd);
+}
+
+// JavaScript method accumulator.max(n)
+Handle<Value> AccumulatorMax(const Arguments& args) {
+  return UpdateAccumulator(args, v8::internal::Accumulator::kMax);
+}
+
+// JavaScript method accumulator.min(n)
+Handle<Value> AccumulatorMin(const Arguments& args) {
+  return UpdateAccumulator(args, v8::internal::Accumulator::kMin);
+}
+
+// JavaScript method accumulator.value()
+// committed value with updates of the current event
+Handle<Value> AccumulatorValue(const Arguments& args) {
+  v8::internal::STM* stm = v8::internal::Isolate::Current()->stm();
+  return Number::New(stm->AccumulatorValue(UnwrapAccumulator(args)));
+}
+
+Handle<FunctionTemplate> AccumulatorTemplate() {
+  Handle<FunctionTemplate> accumulator = FunctionTemplate::New(NewAccumulator);
+  accumulator->SetClassName(String::New("Accumulator"));
+  accumulator->InstanceTemplate()->SetInternalFieldCount(1);
+
+  // methods called on other receivers throw TypeError (illegal invocation)
+  // instead of reading a missing internal field
+  Handle<Signature> signature = Signature::New(accumulator);
+  Handle<ObjectTemplate> prototype = accumulator->PrototypeTemplate();
+  prototype->Set(String::New("add"),
+                 FunctionTemplate::New(AccumulatorAdd, Handle<Value>(),
+                                       signature));
+  prototype->Set(String::New("max"),
+                 FunctionTemplate::New(AccumulatorMax, Handle<Value>(),
+                                       signature));
+  prototype->Set(String::New("min"),
+                 FunctionTemplate::New(AccumulatorMin, Handle<Value>(),
+                                       signature));
+  prototype->Set(String::New("value"),
+                 FunctionTemplate::New(AccumulatorValue, Handle<Value>(),
+                                       signature));
+  return accumulator;
+}
+
+void Finish() {
+  v8::internal::Release_Store(&finished, 1);
+  v8::internal::MemoryBarrier();
+  while (ClaimParkedWorker(&parked_workers)) {
+    parked_semaphore->Signal();
+  }
+  WakeThrottledWorkers();
+}
+
+void Park() {
+  v8::internal::Barrier_AtomicIncrement(&parked_workers, 1);
+  if (!AllDequesEmpty() || v8::internal::Acquire_Load(&finished) != 0) {
+    if (ClaimParkedWorker(&parked_workers)) {
+      return;
+    }
+    // somebody woke us up already
+  }
+  parked_semaphore->Wait();
+}
+
+// throttled worker with empty deque waits until it may run again, returns
+// false when the loops are finished
+bool Throttle(int index) {
+  while (v8::internal::Acquire_Load(&finished) == 0) {
+    if (!IsThrottled(index)) {
+      return true;
+    }
+    v8::internal::Barrier_AtomicIncrement(&throttled_workers, 1);
+    if (!IsThrottled(index) || v8::internal::Acquire_Load(&finished) != 0) {
+      if (ClaimParkedWorker(&throttled_workers)) {
+        continue;
       }
+      // somebody woke us up already
+    }
+    throttled_semaphore->Wait();
+  }
+  return false;
+}
+
+// decides how many workers run events (hill climbing on throughput)
+// - committed events per second are measured over intervals, when the last
+//   change of worker count made throughput worse the direction is reversed
+// - more than half of attempts aborted means workers mostly waste their
+//   work, the count goes down then regardless of throughput
+// - count stays between 1 and --threads, it starts at --threads
+// any worker may adjust it after an event, the one which moves the next
+// adjustment tick forward does it
+class ConcurrencyController {
+ public:
+  ConcurrencyController()
+    : mutex_(v8::internal::OS::CreateMutex()),
+      max_workers_(1),
+      start_time_(0),
+      next_tick_(0),
+      last_time_(0),
+      last_events_(0),
+      last_transactions_(0),
+      last_aborts_(0),
+      last_throughput_(0),
+      direction_(-1) {
+  }
+
+  void Start(int max_workers) {
+    max_workers_ = max_workers;
+    v8::internal::Release_Store(&active_workers, max_workers);
+    start_time_ = v8::internal::OS::Ticks();
+    last_time_ = start_time_;
+    v8::internal::Release_Store(&next_tick_, kIntervalTicks);
+  }
 
-      if (!event_queue.empty()) {
-        e = event_queue.front();
-        event_queue.pop();
-        // count me back in
-        running_threads++;
-        active = true;
-      } else {
-        if (running_threads == 0) {
-          // we are done
-          break;
+  void MaybeAdjust() {
+    if (!v8::internal::FLAG_adaptive_threads || max_workers_ == 1) {
+      return;
+    }
+
+    int64_t now = v8::internal::OS::Ticks();
+    v8::internal::Atomic32 tick =
+      static_cast<v8::internal::Atomic32>((now - start_time_) / kTick);
+    v8::internal::Atomic32 next = v8::internal::Acquire_Load(&next_tick_);
+    if (tick < next ||
+        v8::internal::Acquire_CompareAndSwap(
+            &next_tick_, next, tick + kIntervalTicks) != next) {
+      return;
+    }
+
+    // the lock orders the fields of the last adjustment before this one
+    v8::internal::ScopedLock lock(mutex_);
+    Adjust(now);
+  }
+
+ private:
+  static const int64_t kTick = 1000;  // microseconds
+  static const v8::internal::Atomic32 kIntervalTicks = 50;
+
+  void Adjust(int64_t now) {
+    int events = v8::internal::NoBarrier_Load(&total_events) - last_events_;
+    int transactions =
+      v8::internal::NoBarrier_Load(&total_transactions) - last_transactions_;
+    int aborts =
+      v8::internal::NoBarrier_Load(&aborted_transactions) - last_aborts_;
+    double throughput = events * 1e6 / static_cast<double>(now - last_time_);
+
+    int active = v8::internal::Acquire_Load(&active_workers);
+    int target = active;
+    if (2 * aborts > transactions && active > 1) {
+      direction_ = -1;
+      target = active - 1;
+    } else if (last_throughput_ > 0) {
+      if (throughput < 0.95 * last_throughput_) {
+        // the last step didn't pay off
+        direction_ = -direction_;
+        target = active + direction_;
+      } else if (throughput > 1.05 * last_throughput_) {
+        target = active + direction_;
+      }
+    }
+    if (target < 1) {
+      target = 1;
+    }
+    if (target > max_workers_) {
+      target = max_workers_;
+    }
+
+    if (target != active) {
+      v8::internal::Release_Store(&active_workers, target);
+      v8::internal::MemoryBarrier();
+      if (target > active) {
+        WakeThrottledWorkers();
+      }
+    }
+
+    last_time_ = now;
+    last_events_ += events;
+    last_transactions_ += transactions;
+    last_aborts_ += aborts;
+    last_throughput_ = throughput;
+  }
+
+  v8::internal::Mutex* mutex_;
+  int max_workers_;
+  int64_t start_time_;
+  // time of the next adjustment in ticks since Start
+  v8::internal::Atomic32 next_tick_;
+  int64_t last_time_;
+  int last_events_;
+  int last_transactions_;
+  int last_aborts_;
+  double last_throughput_;
+  int direction_;
+};
+
+ConcurrencyController concurrency_controller;
+
+// idle worker steals events of others, returns NULL when the loops are
+// finished or when the worker is throttled
+// - it spins (yielding the processor) for up to spin_limit rounds and
+//   then parks, the limit doubles when spinning finds an event and halves
+//   when the worker has to park, so workers spin only when events keep
+//   coming
+Event* WaitForEvent(int index, int* spin_limit) {
+  const int kMinSpins = 16;
+  const int kMaxSpins = 4096;
+
+  int spins = 0;
+  while (v8::internal::Acquire_Load(&finished) == 0 && !IsThrottled(index)) {
+    if (!AllDequesEmpty()) {
+      v8::internal::Barrier_AtomicIncrement(&running_threads, 1);
+      Event* e = StealEvent(index);
+      if (e != NULL) {
+        if (spins > 0 && *spin_limit < kMaxSpins) {
+          *spin_limit *= 2;
         }
+        return e;
+      }
+      if (v8::internal::Barrier_AtomicIncrement(&running_threads, -1) == 0) {
+        Finish();
+        return NULL;
       }
     }
 
-    if (e != NULL) {
-      if (v8::internal::FLAG_stm) {
-        // restart transaction until it is successfully committed
-        while (true) {
-          stm->StartTransaction();
-          v8::internal::NoBarrier_AtomicIncrement(&total_transactions, 1);
-
-          HandleScope handle_scope;
-          e->Execute();
-
-          if (stm->CommitTransaction()) {
-            break; // while(true)
-          } else {
-            v8::internal::NoBarrier_AtomicIncrement(&aborted_transactions, 1);
-          }
+    if (spins < *spin_limit) {
+      spins++;
+      v8::internal::Thread::YieldCPU();
+    } else {
+      if (*spin_limit > kMinSpins) {
+        *spin_limit /= 2;
+      }
+      Park();
+      spins = 0;
+    }
+  }
+  return NULL;
+}
+
+// restarts transaction until it is successfully committed (contention
+// manager decides when the next attempt starts), returns number of aborts
+int RunEvent(v8::internal::STM* stm, Event* e) {
+  SpawnedEvents* spawned = CurrentSpawnedEvents();
+  for (int attempt = 0; ; attempt++) {
+    stm->StartTransaction(attempt, e->ReadOnly);
+    v8::internal::NoBarrier_AtomicIncrement(&total_transactions, 1);
+
+    HandleScope handle_scope;
+    e->Execute();
+
+    if (stm->CommitTransaction()) {
+      spawned->Flush();
+      v8::internal::NoBarrier_AtomicIncrement(&total_events, 1);
+      return attempt;
+    } else {
+      spawned->Drop();
+      v8::internal::NoBarrier_AtomicIncrement(&aborted_transactions, 1);
+    }
+  }
+}
+
+// runs events in one transaction (one attempt), returns false if it aborted
+// - group is read-only only if all its events are
+// - events after the transaction was aborted are skipped
+bool RunBatch(v8::internal::STM* stm, Event** events, int count) {
+  bool read_only = true;
+  for (int i = 0; i < count; i++) {
+    read_only = read_only && events[i]->ReadOnly;
+  }
+
+  stm->StartTransaction(0, read_only);
+  v8::internal::NoBarrier_AtomicIncrement(&total_transactions, 1);
+  for (int i = 0; i < count && !stm->IsDoomed(); i++) {
+    HandleScope handle_scope;
+    events[i]->Execute();
+  }
+
+  if (stm->CommitTransaction()) {
+    CurrentSpawnedEvents()->Flush();
+    v8::internal::NoBarrier_AtomicIncrement(&total_events, count);
+    return true;
+  }
+  CurrentSpawnedEvents()->Drop();
+  v8::internal::NoBarrier_AtomicIncrement(&aborted_transactions, 1);
+  return false;
+}
+
+// number of events run in one transaction grows by one after each group
+// committed without abort in short time and halves after abort, so groups
+// stay large only while conflicts are rare and transactions short
+// (--event-batch limits the size, 1 disables batching)
+void AdjustBatchLimit(int* batch_limit, bool aborted, int count,
+                      int64_t latency) {
+  const int64_t kMaxLatency = 1000;  // microseconds
+
+  int max_limit = v8::internal::FLAG_event_batch;
+  if (max_limit > kMaxBatch) {
+    max_limit = kMaxBatch;
+  }
+
+  if (aborted) {
+    *batch_limit = *batch_limit > 1 ? *batch_limit / 2 : 1;
+  } else if (count == *batch_limit && latency < kMaxLatency &&
+             *batch_limit < max_limit) {
+    (*batch_limit)++;
+  }
+}
+
+void EventLoop(v8::internal::STM* stm, int index) {
+  EventDeque* deque = event_deques[index];
+  v8::internal::Thread::SetThreadLocal(event_deque_key, deque);
+  v8::internal::Thread::SetThreadLocal(spawned_events_key,
+                                       &spawned_events[index]);
+  int spin_limit = 64;
+  int batch_limit = 1;
+
+  // loop until all deques are empty and others are idle too
+  while (true) {
+    Event* e = deque->Pop();
+    if (e == NULL && !IsThrottled(index)) {
+      e = StealEvent(index);
+    }
+
+    if (e == NULL) {
+      // count me out
+      if (v8::internal::Barrier_AtomicIncrement(&running_threads, -1) == 0) {
+        // we are done
+        Finish();
+        return;
+      }
+      e = IsThrottled(index) ? NULL : WaitForEvent(index, &spin_limit);
+      if (e == NULL) {
+        if (!Throttle(index)) {
+          return;
         }
-      } else {
-        HandleScope handle_scope;
-        e->Execute();
+        // count me back in, the deque is empty so the loop goes back to
+        // stealing or waiting
+        v8::internal::Barrier_AtomicIncrement(&running_threads, 1);
+        continue;
       }
-      delete e;
     }
+
+    if (!v8::internal::FLAG_stm) {
+      HandleScope handle_scope;
+      e->Execute();
+      spawned_events[index].Flush();
+      v8::internal::NoBarrier_AtomicIncrement(&total_events, 1);
+      FinishEvent(e);
+      concurrency_controller.MaybeAdjust();
+      continue;
+    }
+
+    // group the event with events queued after it on this worker
+    Event* batch[kMaxBatch];
+    int count = 1;
+    batch[0] = e;
+    while (count < batch_limit) {
+      Event* next = deque->Pop();
+      if (next == NULL) {
+        break;
+      }
+      batch[count++] = next;
+    }
+
+    int64_t start = v8::internal::OS::Ticks();
+    bool aborted;
+    if (count > 1) {
+      aborted = !RunBatch(stm, batch, count);
+      if (aborted) {
+        // split the group, each event runs alone
+        for (int i = 0; i < count; i++) {
+          RunEvent(stm, batch[i]);
+        }
+      }
+    } else {
+      aborted = RunEvent(stm, e) > 0;
+    }
+    AdjustBatchLimit(&batch_limit, aborted, count,
+                     v8::internal::OS::Ticks() - start);
+
+    for (int i = 0; i < count; i++) {
+      FinishEvent(batch[i]);
+    }
+    concurrency_controller.MaybeAdjust();
   }
 }
 
@@ -145,10 +909,11 @@ class WorkerThread : public v8::internal::Thread {
   Persistent<Context> context_;
   Isolate* isolate_;
   v8::internal::STM* stm_;
+  int index_;
 public:
   WorkerThread(const char* name, Handle<Context> context,
-               v8::internal::STM* stm)
-    : v8::internal::Thread(name), stm_(stm) {
+               v8::internal::STM* stm, int index)
+    : v8::internal::Thread(name), stm_(stm), index_(index) {
     isolate_ = Isolate::GetCurrent();
     context_ = Persistent<Context>::New(context);
   }
@@ -163,15 +928,14 @@ public:
     Context::Scope context_scope(context_);
 
     // run event loop
-    EventLoop(stm_);
+    EventLoop(stm_, index_);
   }
 };
 
 int main(int argc, char **argv) {
   // disable V8 optimisations
   char flags[1024] = { 0 };
-  strcat(flags, " --nouse-ic"); // disable inline caching
-  strcat(flags, " --noinline-new"); // disable inline allocation
+  strcat(flags, " --noinline-new"); // threads allocate from own buffers
   strcat(flags, " --noopt"); // disable profiling thread
   strcat(flags, " --always-full-compiler"); // disable crankshaft
   V8::SetFlagsFromString(flags, strlen(flags));
@@ -197,6 +961,13 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (!v8::internal::ContentionManager::IsPolicy(
+          v8::internal::FLAG_stm_contention)) {
+    printf("Unknown contention policy %s.\n",
+           v8::internal::FLAG_stm_contention);
+    return 1;
+  }
+
   V8::Initialize();
 
   Isolate::Scope isolate_scope(Isolate::GetCurrent());
@@ -208,7 +979,11 @@ int main(int argc, char **argv) {
   Handle<ObjectTemplate> global = ObjectTemplate::New();
   global->Set(String::New("load"),  FunctionTemplate::New(Load));
   global->Set(String::New("async"), FunctionTemplate::New(Async));
+  global->Set(String::New("asyncKeyed"), FunctionTemplate::New(AsyncKeyed));
+  global->Set(String::New("asyncReadOnly"),
+              FunctionTemplate::New(AsyncReadOnly));
   global->Set(String::New("print"), FunctionTemplate::New(Print));
+  global->Set(String::New("Accumulator"), AccumulatorTemplate());
 
   // create a new context
   Persistent<Context> context = Context::New(NULL, global);
@@ -220,39 +995,63 @@ int main(int argc, char **argv) {
   v8::internal::STM* stm =
     reinterpret_cast<v8::internal::Isolate*>(isolate)->stm();
 
+  // events of the initial script go to the deque of the main thread, other
+  // workers steal them
+  for (int i = 0; i < threads; i++) {
+    event_deques[i] = new EventDeque();
+  }
+  event_deques_count = threads;
+  running_threads = threads;
+  concurrency_controller.Start(threads);
+  v8::internal::Thread::SetThreadLocal(event_deque_key, event_deques[0]);
+  v8::internal::Thread::SetThreadLocal(spawned_events_key, &spawned_events[0]);
+
   int64_t start_time = v8::internal::OS::Ticks();
 
   // load and run the initial script in a transaction
   if (v8::internal::FLAG_stm) {
     stm->StartTransaction();
     Script::New(ReadFile(filename), String::New(filename))->Run();
-    ASSERT(stm->CommitTransaction());
+    // commit must not be compiled out with the assert
+    bool committed = stm->CommitTransaction();
+    ASSERT(committed);
+    v8::internal::USE(committed);
   } else {
     Script::New(ReadFile(filename), String::New(filename))->Run();
   }
+  spawned_events[0].Flush();
 
   // run event loops in worker threads (less the loop running in main thread)
   WorkerThread* thread[MAX_THREADS];
   for (int i = 0; i < threads-1; i++) {
     char name[100];
     sprintf(name, "Worker %d", i+1);
-    thread[i] = new WorkerThread(name, context, stm);
+    thread[i] = new WorkerThread(name, context, stm, i+1);
     thread[i]->Start();
   }
 
   // run event loop in main thread too
   v8::internal::Thread::SetThreadLocal(thread_name_key, (void*)"Worker 0");
-  EventLoop(stm);
+  EventLoop(stm, 0);
 
-  // stop when all threads are idle and the event queue is empty
+  // stop when all threads are idle and the deques are empty
   for (int i = 0; i < threads-1; i++) {
     thread[i]->Join();
   }
+  for (int i = 0; i < threads; i++) {
+    delete event_deques[i];
+  }
 
   int64_t stop_time = v8::internal::OS::Ticks();
   int milliseconds = static_cast<int>(stop_time - start_time) / 1000;
-  printf("%d threads, %d ms, %d transactions, %d aborts\n",
-    threads, milliseconds, total_transactions, aborted_transactions);
+  printf("%d threads, %d ms, %d events, %d transactions, %d aborts\n",
+    threads, milliseconds, total_events, total_transactions,
+    aborted_transactions);
+  if (v8::internal::FLAG_stm && v8::internal::FLAG_stm_stats) {
+    printf("%d of %d workers running events at exit\n",
+           v8::internal::Acquire_Load(&active_workers), threads);
+    stm->PrintStatistics();
+  }
 
   // dispose the persistent context
   context.Dispose();
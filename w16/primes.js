@@ -1,6 +1,11 @@
 // adapters for execution under Node.js
 async = typeof async != 'undefined' ? async : process.nextTick;
 print = typeof print != 'undefined' ? print : console.log;
+Accumulator = typeof Accumulator != 'undefined' ? Accumulator :
+  function (value) {
+    this.add = function (n) { value += n; };
+    this.value = function () { return value; };
+  };
 
 function isPrime(n) {
   for (var i = 2; i*i <= n; i++) {
@@ -13,13 +18,15 @@ function isPrime(n) {
 // this object is shared between event
 // we don't use global properties because they are not supported yet
 var counters = {
-  processed : 0,
-  primes : 0
+  processed : 0
 };
 
+// updates of accumulator don't conflict
+var primes = new Accumulator(0);
+
 function inc_primes(n) {
-  counters.primes += n;
-  return counters.primes;
+  primes.add(n);
+  return primes.value();
 }
 
 function inc_processed(n) {